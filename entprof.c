@@ -0,0 +1,159 @@
+/*
+Sliding window entropy profile
+
+Whole-file entropy hides a packed or encrypted region inside a large
+binary, what we need is the entropy of every window. Counting each window
+from scratch is O(W) per step, but moving the window by one byte changes
+only two counters, and since
+
+	H = log2(W) - sum(c * log2(c)) / W
+
+only two terms of the sum: c * log2(c) for the counter that went up and for
+the one that went down. With the table from hist.h this is O(1) per byte.
+The sum is recomputed from the counters once per window length, so the
+floating point error doesn't accumulate over gigabytes.
+
+./entprof [-w window] [-s stride] [-t threshold] [-q] file...
+
+prints "offset entropy" for every stride, and for the last window of the
+file, and the ranges above threshold
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hist.h"
+
+struct range {
+	size_t start, end;
+	double max;
+};
+
+void report(const char *name, struct range *r)
+{
+	printf("%s: %zx-%zx (%zu bytes) max %.3f\n", name, r->start, r->end, r->end - r->start, r->max);
+}
+
+void profile(const char *name, const uint8_t *b, size_t len, size_t w, size_t stride, double thr, int quiet)
+{
+	uint64_t f[256];
+	uint32_t c[256];
+	size_t pos, i, k, step, nr = 0, since = 0;
+	double s = 0, lw = log2((double)w);
+	struct range r = { 0, 0, 0 };
+	int in = 0;
+
+	if (len < w) {
+		bzero(f, sizeof(f));
+		hist4(f, b, len);
+		printf("%s: %zu bytes, smaller than window, entropy %.3f\n", name, len, hist_entropy(f, len));
+		return;
+	}
+	bzero(f, sizeof(f));
+	hist4(f, b, w);
+	for (i = 0; i < 256; i++) {
+		c[i] = f[i];
+		s += nlogn_tab[c[i]];
+	}
+	for (pos = 0; ; pos += step) {
+		double e = lw - s / w;
+		if (!quiet)
+			printf("%zx %.4f\n", pos, e);
+		if (e >= thr) {
+			if (!in) {
+				r.start = pos;
+				r.max = 0;
+				in = 1;
+			}
+			r.end = pos + w;
+			if (e > r.max)
+				r.max = e;
+		} else if (in) {
+			report(name, &r);
+			nr++;
+			in = 0;
+		}
+		/* a short last step, so the last window ends at len */
+		if ((step = len - w - pos < stride ? len - w - pos : stride) == 0)
+			break;
+		/* slide: one byte out, one byte in, two sums to shorten the chain */
+		double d[2] = { 0, 0 };
+		for (k = 0; k < step; k++) {
+			unsigned o = b[pos + k], n = b[pos + w + k];
+			uint32_t co = --c[o];
+			double t = nlogn_tab[co] - nlogn_tab[co + 1];
+			uint32_t cn = c[n]++;
+			d[k & 1] += t + nlogn_tab[cn + 1] - nlogn_tab[cn];
+		}
+		s += d[0] + d[1];
+		if ((since += step) >= w) {
+			for (s = 0, i = 0; i < 256; i++)
+				s += nlogn_tab[c[i]];
+			since = 0;
+		}
+	}
+	if (in) {
+		report(name, &r);
+		nr++;
+	}
+	printf("%s: %zu bytes, %zu ranges above %.2f\n", name, len, nr, thr);
+}
+
+int main(int argc, char **argv)
+{
+	size_t w = 4096, stride = 256;
+	double thr = 7.2;
+	int opt, quiet = 0;
+
+	while ((opt = getopt(argc, argv, "w:s:t:q")) != -1)
+		switch (opt) {
+		case 'w':
+			w = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			stride = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			thr = atof(optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			printf("Usage: %s [-w window] [-s stride] [-t threshold] [-q] file...\n", argv[0]);
+			return 2;
+		}
+	if (w == 0 || stride == 0 || optind >= argc) {
+		printf("Usage: %s [-w window] [-s stride] [-t threshold] [-q] file...\n", argv[0]);
+		return 2;
+	}
+	nlogn_init(w);
+
+	for (int i = optind; i < argc; i++) {
+		struct stat st;
+		int h = open(argv[i], O_RDONLY);
+		if (h < 0 || fstat(h, &st) < 0) {
+			perror(argv[i]);
+			return 2;
+		}
+		if (st.st_size == 0) {
+			close(h);
+			continue;
+		}
+		uint8_t *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, h, 0);
+		close(h);
+		if (m == MAP_FAILED) {
+			perror(argv[i]);
+			return 2;
+		}
+		madvise(m, st.st_size, MADV_SEQUENTIAL);
+		profile(argv[i], m, st.st_size, w, stride, thr, quiet);
+		munmap(m, st.st_size);
+	}
+	return 0;
+}
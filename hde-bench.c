@@ -0,0 +1,197 @@
+/*
+hde64 decoding speed on a real .text
+
+./hde-bench [file]	(libc by default)
+
+Linear sweep over .text of an ELF64 file, the way ops.c and unexport.c
+used to do it, hde64_disasm() into hde64s and the fields copied out, and
+with hde64_batch() into the same arrays, and boundaries only with
+hde64_len(). Checks that they give the same (hde64_len() at every byte
+offset and on random bytes, not only at instruction starts) and prints
+the best of five runs in instructions per second and MB/s.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hde64.h"
+
+#define RUNS	5
+
+struct arrays {
+	uint32_t *off, *flags, *disp;
+	uint8_t *len, *opcode, *opcode2, *modrm;
+	uint64_t *imm;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int alloc(struct arrays *a, size_t n)
+{
+	a->off = malloc(n * 4);
+	a->flags = malloc(n * 4);
+	a->disp = malloc(n * 4);
+	a->len = malloc(n);
+	a->opcode = malloc(n);
+	a->opcode2 = malloc(n);
+	a->modrm = malloc(n);
+	a->imm = malloc(n * 8);
+	return a->off && a->flags && a->disp && a->len && a->opcode && a->opcode2 && a->modrm && a->imm ? 0 : -1;
+}
+
+static size_t one_by_one(const uint8_t *code, size_t size, struct arrays *a)
+{
+	size_t i, n;
+	for (i = 0, n = 0; i < size; i += a->len[n++]) {
+		hde64s hs;
+		a->len[n] = hde64_disasm(code + i, &hs);
+		a->off[n] = i;
+		a->opcode[n] = hs.opcode;
+		a->opcode2[n] = hs.opcode2;
+		a->modrm[n] = hs.modrm;
+		a->flags[n] = hs.flags;
+		a->imm[n] = hs.flags & F_IMM64 ? hs.imm.imm64 : hs.flags & F_IMM32 ? hs.imm.imm32 :
+			hs.flags & F_IMM16 ? hs.imm.imm16 : hs.imm.imm8;
+		a->disp[n] = hs.flags & F_DISP32 ? hs.disp.disp32 : hs.flags & F_DISP16 ? hs.disp.disp16 : hs.disp.disp8;
+	}
+	return n;
+}
+
+static size_t batch(const uint8_t *code, size_t size, struct arrays *a)
+{
+	hde64_soa soa = { a->off, a->len, a->opcode, a->opcode2, a->modrm, a->flags, a->imm, a->disp };
+	return hde64_batch(code, size, size, &soa);
+}
+
+static size_t lengths(const uint8_t *code, size_t size, uint32_t *off, uint8_t *len)
+{
+	size_t i, n;
+	for (i = 0, n = 0; i < size; i += len[n++]) {
+		off[n] = i;
+		len[n] = hde64_len(code + i);
+	}
+	return n;
+}
+
+/* hde64_len() against hde64_disasm(), anywhere; offset of the first mismatch or -1 */
+static long check_len(const uint8_t *code, size_t size)
+{
+	static uint8_t rnd[1 << 20];
+	uint64_t x = 88172645463325252ULL;
+	hde64s hs;
+	size_t i;
+	for (i = 0; i < size; i++)
+		if (hde64_len(code + i) != hde64_disasm(code + i, &hs))
+			return i;
+	for (i = 0; i < sizeof(rnd); i++) {
+		x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+		/* bias towards prefixes, REX and 0f */
+		rnd[i] = x % 4 ? x >> 32 : "\x66\x67\xf2\xf3\xf0\x2e\x48\x41\x0f\x0f"[(x >> 32) % 10];
+	}
+	/* and runs of prefixes longer than 15 */
+	memset(rnd + 4096, 0x66, 20);
+	memset(rnd + 8192, 0xf3, 17);
+	rnd[8192 + 17] = 0x48;
+	for (i = 0; i < sizeof(rnd) - 16; i++)
+		if (hde64_len(rnd + i) != hde64_disasm(rnd + i, &hs))
+			return size + i;
+	return -1;
+}
+
+static void report(const char *name, size_t n, size_t size, double t)
+{
+	printf("%-12s %8zu insn %8.1f M insn/s %8.1f MB/s\n", name, n, n / t / 1e6, size / t / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : "/lib/x86_64-linux-gnu/libc.so.6";
+	struct stat st;
+	int h = open(path, O_RDONLY), i;
+
+	if (h < 0 || fstat(h, &st) < 0) {
+		perror(path);
+		return 2;
+	}
+	uint8_t *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, h, 0);
+	close(h);
+	if (m == MAP_FAILED) {
+		perror("mmap");
+		return 2;
+	}
+	Elf64_Ehdr *eh = (Elf64_Ehdr *)m;
+	if (st.st_size < (off_t)sizeof(Elf64_Ehdr) || memcmp(eh->e_ident, ELFMAG, SELFMAG) || eh->e_shoff >= (size_t)st.st_size ||
+	    eh->e_shstrndx >= eh->e_shnum) {
+		printf("%s: not an ELF64 file\n", path);
+		return 2;
+	}
+	Elf64_Shdr *sh = (Elf64_Shdr *)(m + eh->e_shoff), *text = NULL;
+	for (i = 0; i < eh->e_shnum; i++)
+		if (strcmp((char *)m + sh[eh->e_shstrndx].sh_offset + sh[i].sh_name, ".text") == 0)
+			text = &sh[i];
+	if (text == NULL || text->sh_offset + text->sh_size > (size_t)st.st_size) {
+		printf("%s: no .text\n", path);
+		return 2;
+	}
+	const uint8_t *code = m + text->sh_offset;
+	size_t size = text->sh_size, n1 = 0, n2 = 0, n3 = 0;
+	long bad;
+	struct arrays a, b;
+	uint32_t *off = malloc(size * 4);
+	uint8_t *len = malloc(size);
+	if (alloc(&a, size) < 0 || alloc(&b, size) < 0 || off == NULL || len == NULL) {
+		perror("malloc");
+		return 2;
+	}
+	if (size < 16) {
+		printf("%s: .text too short\n", path);
+		return 2;
+	}
+	if ((bad = check_len(code, size - 16)) >= 0) {
+		printf("FAILED: hde64_len at %ld\n", bad);
+		return 1;
+	}
+	double best[3] = { 1e9, 1e9, 1e9 };
+	for (int r = 0; r < RUNS; r++) {
+		double t0 = now();
+		n1 = one_by_one(code, size, &a);
+		double t1 = now();
+		n2 = batch(code, size, &b);
+		double t2 = now();
+		if (t1 - t0 < best[0])
+			best[0] = t1 - t0;
+		if (t2 - t1 < best[1])
+			best[1] = t2 - t1;
+		n3 = lengths(code, size, off, len);
+		double t3 = now();
+		if (t3 - t2 < best[2])
+			best[2] = t3 - t2;
+	}
+	if (n1 != n2 || memcmp(a.off, b.off, n1 * 4) || memcmp(a.len, b.len, n1) || memcmp(a.opcode, b.opcode, n1) ||
+	    memcmp(a.opcode2, b.opcode2, n1) || memcmp(a.modrm, b.modrm, n1) || memcmp(a.flags, b.flags, n1 * 4) ||
+	    memcmp(a.imm, b.imm, n1 * 8) || memcmp(a.disp, b.disp, n1 * 4)) {
+		printf("FAILED: hde64_batch differs\n");
+		return 1;
+	}
+	if (n3 != n1 || memcmp(a.off, off, n1 * 4) || memcmp(a.len, len, n1)) {
+		printf("FAILED: hde64_len differs\n");
+		return 1;
+	}
+	printf("%s: .text %zu bytes\n", path, size);
+	report("hde64_disasm", n1, size, best[0]);
+	report("hde64_batch", n2, size, best[1]);
+	report("hde64_len", n3, size, best[2]);
+	return 0;
+}
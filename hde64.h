@@ -178,6 +178,31 @@ extern "C" {
 /* __cdecl */
 unsigned int hde64_disasm(const void *code, hde64s *hs);
 
+/*
+ * Linear sweep: instructions from code until size bytes are covered or
+ * max are decoded, fields go to arrays (struct of arrays, one entry per
+ * instruction), arrays left NULL are not filled. Returns the number of
+ * instructions. Up to 15 bytes past size may be read.
+ */
+typedef struct {
+    uint32_t *off;      /* from code */
+    uint8_t *len;
+    uint8_t *opcode;
+    uint8_t *opcode2;
+    uint8_t *modrm;
+    uint32_t *flags;
+    uint64_t *imm;      /* imm64, or the smaller one zero-extended */
+    uint32_t *disp;
+} hde64_soa;
+
+size_t hde64_batch(const void *code, size_t size, size_t max, hde64_soa *out);
+
+/*
+ * Length only, same as hde64_disasm() returns, without the error checks
+ * and operands.
+ */
+unsigned int hde64_len(const void *code);
+
 #ifdef __cplusplus
 }
 #endif
@@ -194,7 +219,15 @@ unsigned int hde64_disasm(const void *code, hde64s *hs);
 #pragma warning(disable:4706)
 #pragma warning(disable:26451)
 
-unsigned int hde64_disasm(const void* code, hde64s* hs)
+#ifdef _MSC_VER
+#define HDE64_INLINE static __forceinline
+#else
+#define HDE64_INLINE static inline __attribute__((always_inline))
+#endif
+
+// the decoder, inlined into hde64_disasm() and hde64_batch()
+HDE64_INLINE
+unsigned int hde64_decode(const void* code, hde64s* hs)
 {
     uint8_t x, c = 0, * p = (uint8_t*)code, cflags, opcode, pref = 0;
     uint8_t* ht = hde64_table, m_mod, m_reg, m_rm, disp_size = 0;
@@ -530,4 +563,150 @@ disasm_done:
 
     return (unsigned int)hs->len;
 }
-#pragma warning(pop)
\ No newline at end of file
+#pragma warning(pop)
+
+unsigned int hde64_disasm(const void* code, hde64s* hs)
+{
+    return hde64_decode(code, hs);
+}
+
+// hs never leaves the loop, so the compiler drops what isn't stored
+size_t hde64_batch(const void* code, size_t size, size_t max, hde64_soa* out)
+{
+    const uint8_t* p = (const uint8_t*)code;
+    size_t i = 0, n;
+
+    for (n = 0; i < size && n < max; n++) {
+        hde64s hs;
+        unsigned int len = hde64_decode(p + i, &hs);
+        if (out->off)
+            out->off[n] = (uint32_t)i;
+        if (out->len)
+            out->len[n] = (uint8_t)len;
+        if (out->opcode)
+            out->opcode[n] = hs.opcode;
+        if (out->opcode2)
+            out->opcode2[n] = hs.opcode2;
+        if (out->modrm)
+            out->modrm[n] = hs.modrm;
+        if (out->flags)
+            out->flags[n] = hs.flags;
+        if (out->imm)
+            out->imm[n] = hs.flags & F_IMM64 ? hs.imm.imm64 :
+                hs.flags & F_IMM32 ? hs.imm.imm32 :
+                hs.flags & F_IMM16 ? hs.imm.imm16 : hs.imm.imm8;
+        if (out->disp)
+            out->disp[n] = hs.flags & F_DISP32 ? hs.disp.disp32 :
+                hs.flags & F_DISP16 ? hs.disp.disp16 : hs.disp.disp8;
+        i += len;
+    }
+    return n;
+}
+
+// the length rules of hde64_decode(), quirks included, nothing else
+unsigned int hde64_len(const void* code)
+{
+    const uint8_t* p = (const uint8_t*)code, * ht = hde64_table;
+    uint8_t x, c = 0, cflags, pref = 0, op2 = 0, op64 = 0;
+    unsigned int len;
+
+    for (x = 16; x; x--)
+        switch (c = *p++) {
+        case 0xf0: case 0xf2: case 0xf3:
+        case 0x26: case 0x2e: case 0x36:
+        case 0x3e: case 0x64: case 0x65:
+            break;
+        case 0x66:
+            pref |= PRE_66;
+            break;
+        case 0x67:
+            pref |= PRE_67;
+            break;
+        default:
+            goto pref_done;
+        }
+pref_done:
+
+    if ((c & 0xf0) == 0x40) {
+        if ((c & 8) && (*p & 0xf8) == 0xb8)
+            op64++;
+        // REX REX is an error, nothing follows
+        if (((c = *p++) & 0xf0) == 0x40)
+            goto done;
+    }
+
+    if (c == 0x0f) {
+        op2 = c = *p++;
+        ht += DELTA_OPCODES;
+    }
+    else if (c >= 0xa0 && c <= 0xa3) {
+        op64++;
+        if (pref & PRE_67)
+            pref |= PRE_66;
+        else
+            pref &= ~PRE_66;
+    }
+
+    cflags = ht[ht[c / 4] + (c % 4)];
+    if (cflags == C_ERROR)
+        cflags = (c & -3) == 0x24 ? C_MODRM : 0;
+    else if (cflags & C_GROUP)
+        cflags = ht[cflags & 0x7f];
+
+    if (cflags & C_MODRM) {
+        uint8_t m = *p++, m_mod = m >> 6, m_rm = m & 7, m_reg = (m >> 3) & 7, disp_size = 0;
+
+        // mov to/from cr, dr
+        if (op2 && c >= 0x20 && c <= 0x23)
+            m_mod = 3;
+        if (m_reg <= 1) {
+            if (c == 0xf6)
+                cflags |= C_IMM8;
+            else if (c == 0xf7)
+                cflags |= C_IMM_P66;
+        }
+        switch (m_mod) {
+        case 0:
+            if (pref & PRE_67)
+                disp_size = m_rm == 6 ? 2 : 0;
+            else
+                disp_size = m_rm == 5 ? 4 : 0;
+            break;
+        case 1:
+            disp_size = 1;
+            break;
+        case 2:
+            disp_size = pref & PRE_67 ? 2 : 4;
+        }
+        if (m_mod != 3 && m_rm == 4 && (*p++ & 7) == 5 && !(m_mod & 1))
+            disp_size = 4;
+        p += disp_size;
+    }
+
+    if (cflags & C_IMM_P66) {
+        if (cflags & C_REL32) {
+            p += pref & PRE_66 ? 2 : 4;
+            goto done;
+        }
+        if (op64)
+            p += 8;
+        else if (!(pref & PRE_66))
+            p += 4;
+        else
+            goto imm16;
+    }
+    if (cflags & C_IMM16) {
+    imm16:
+        p += 2;
+    }
+    if (cflags & C_IMM8)
+        p++;
+    if (cflags & C_REL32)
+        p += 4;
+    else if (cflags & C_REL8)
+        p++;
+
+done:
+    len = (unsigned int)(p - (const uint8_t*)code);
+    return len > 15 ? 15 : len;
+}
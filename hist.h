@@ -0,0 +1,95 @@
+/*
+Byte histogram and entropy kernels, used by huff-*.c
+
+freq[b[i]]++ is a load-increment-store, and runs of the same byte make each
+one wait for the previous store. Counting into four tables breaks the chain,
+the tables are merged at the end. Counters are 32-bit and flushed every 1G
+bytes, so the sums can go past 4G.
+
+Entropy is H = log2(N) - sum(c * log2(c)) / N, with c * log2(c) taken from
+a table instead of calling log2 for every symbol. Counts above the table
+size (large buffers) fall back to log2.
+*/
+#ifndef _HIST_H_
+#define _HIST_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* adds byte counts of b[0..len) to freq */
+static inline void hist4(uint64_t freq[256], const uint8_t *b, size_t len)
+{
+	uint32_t c[4][256];
+	int i;
+	while (len) {
+		size_t n = len < (1UL << 30) ? len : (1UL << 30);
+		const uint8_t *e = b + (n & ~15UL);
+		len -= n;
+		memset(c, 0, sizeof(c));
+		for (; b < e; b += 16) {
+			uint64_t x, y;
+			memcpy(&x, b, 8);
+			memcpy(&y, b + 8, 8);
+			c[0][(uint8_t)x]++;
+			c[1][(uint8_t)(x >> 8)]++;
+			c[2][(uint8_t)(x >> 16)]++;
+			c[3][(uint8_t)(x >> 24)]++;
+			c[0][(uint8_t)(x >> 32)]++;
+			c[1][(uint8_t)(x >> 40)]++;
+			c[2][(uint8_t)(x >> 48)]++;
+			c[3][x >> 56]++;
+			c[0][(uint8_t)y]++;
+			c[1][(uint8_t)(y >> 8)]++;
+			c[2][(uint8_t)(y >> 16)]++;
+			c[3][(uint8_t)(y >> 24)]++;
+			c[0][(uint8_t)(y >> 32)]++;
+			c[1][(uint8_t)(y >> 40)]++;
+			c[2][(uint8_t)(y >> 48)]++;
+			c[3][y >> 56]++;
+		}
+		for (e = b + (n & 15); b < e; b++)
+			c[0][*b]++;
+		for (i = 0; i < 256; i++)
+			freq[i] += c[0][i] + c[1][i] + c[2][i] + c[3][i];
+	}
+}
+
+/* c * log2(c) for c <= nlogn_max */
+static double *nlogn_tab;
+static size_t nlogn_max;
+
+/* not thread safe, call it before starting threads */
+static inline void nlogn_init(size_t max)
+{
+	if (nlogn_tab && nlogn_max >= max)
+		return;
+	free(nlogn_tab);
+	nlogn_tab = malloc((max + 1) * sizeof(double));
+	nlogn_tab[0] = 0;
+	for (size_t c = 1; c <= max; c++)
+		nlogn_tab[c] = c * log2((double)c);
+	nlogn_max = max;
+}
+
+static inline double nlogn(uint64_t c)
+{
+	return c <= nlogn_max ? nlogn_tab[c] : c * log2((double)c);
+}
+
+/* entropy in bits per byte, total is the sum of freq */
+static inline double hist_entropy(const uint64_t freq[256], uint64_t total)
+{
+	double s = 0;
+	int i;
+	if (total == 0)
+		return 0;
+	if (nlogn_tab == NULL)
+		nlogn_init(65535);
+	for (i = 0; i < 256; i++)
+		s += nlogn(freq[i]);
+	return log2((double)total) - s / total;
+}
+
+#endif /* _HIST_H_ */
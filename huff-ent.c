@@ -65,11 +65,14 @@ https://modexp.wordpress.com/2023/04/07/shellcode-entropy-reduction-with-base-n-
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include <time.h>
 #include <string.h>
 #include <ctype.h>
 
+#include "hist.h"
+
 double L(double E, double p)
 {
 	return (E + p*log2f(p) + (1.0 - p)*(log2f(1 - p))) / (1 - p);
@@ -257,19 +260,10 @@ int encode_char(unsigned char *out, int *bits, node_t *n, unsigned char v, unsig
 
 double getent(unsigned char *b, int len)
 {
-	int i;
-	unsigned freq[256];
+	uint64_t freq[256];
 	bzero(freq, sizeof(freq));
-	for (int i = 0; i < len; i++)
-		freq[b[i]]++;
-	double e = 0;
-	for (int i = 0; i < 256; i++) {
-		if (freq[i]) {
-			double p = (double)freq[i] / (double)len;
-			e -= p * log2f(p);
-		}
-	}
-	return e;
+	hist4(freq, b, len);
+	return hist_entropy(freq, len);
 }
 
 void huff(double p[], int n, unsigned char *in, int len, unsigned char *out)
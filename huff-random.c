@@ -7,6 +7,10 @@
 #include <ctype.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "hist.h"
 
 typedef struct node {
 	unsigned char v;
@@ -14,6 +18,16 @@ typedef struct node {
 	struct node *left, *right, *next;
 } node_t;
 
+/* block sized histogram */
+static void count(unsigned freq[256], uint8_t *in, int l)
+{
+	uint64_t f[256];
+	bzero(f, sizeof(f));
+	hist4(f, in, l);
+	for (int i = 0; i < 256; i++)
+		freq[i] = f[i];
+}
+
 int encode(uint8_t *out, uint8_t *in, int l)
 {
 	uint8_t *start = out;
@@ -46,9 +60,7 @@ int encode(uint8_t *out, uint8_t *in, int l)
 	/* count frequencies */
 	int i, j;
 	unsigned int freq[256];
-	bzero(freq, sizeof(freq));
-	for (i = 0; i < l; i++)
-		freq[in[i]]++;
+	count(freq, in, l);
 
 	/* make the list of nodes sorted by freq, lowest first */
 	node_t *insert(node_t *list, node_t *node) {
@@ -145,7 +157,7 @@ int encode(uint8_t *out, uint8_t *in, int l)
 	while (bits < 8)
 		putbit(0);
 
-	return out - start;
+	return out - start + 1;
 }
 
 void decode(uint8_t *out, uint8_t *in, int l)
@@ -201,13 +213,986 @@ void decode(uint8_t *out, uint8_t *in, int l)
 	}
 }
 
+/*
+Canonical header. The tree above costs 1 bit per node and 8 bits per leaf,
+which is the most of the output for a short string. In canonical Huffman only
+the code lengths matter, so we send the set of used symbols (gaps between them
+in Elias gamma) and the length of each one. Codes are limited to MAXLEN bits,
+then the decoder is a single table lookup per symbol and needs no tree at all.
+The price is the polymorphism: canonical codes are the same for the same input.
+*/
+#define	MAXLEN	11
+
+/* MSB-first bit writer/reader, 64-bit accumulator */
+typedef struct {
+	uint8_t *p;
+	uint64_t acc;
+	int n;
+} bitw_t;
+
+static void bw_put(bitw_t *w, uint32_t v, int n)
+{
+	w->acc = (w->acc << n) | v;
+	w->n += n;
+	while (w->n >= 8) {
+		w->n -= 8;
+		*w->p++ = w->acc >> w->n;
+	}
+}
+
+static uint8_t *bw_flush(bitw_t *w)
+{
+	if (w->n)
+		*w->p++ = w->acc << (8 - w->n);
+	w->n = 0;
+	return w->p;
+}
+
+typedef struct {
+	const uint8_t *p, *end;
+	uint64_t acc;
+	int n;
+	int over;	/* zero bits put in past the end */
+} bitr_t;
+
+/* at least 56 valid bits after refill, zeroes past the end */
+static inline void br_fill(bitr_t *r)
+{
+	if (r->end - r->p >= 8) {
+		uint64_t v;
+		memcpy(&v, r->p, 8);
+		r->acc |= __builtin_bswap64(v) >> r->n;
+		r->p += (63 - r->n) >> 3;
+		r->n |= 56;
+	} else {
+		while (r->n <= 56) {
+			if (r->p < r->end)
+				r->acc |= (uint64_t)*r->p++ << (56 - r->n);
+			else
+				r->over += 8;
+			r->n += 8;
+		}
+	}
+}
+
+static inline uint32_t br_peek(bitr_t *r, int n)
+{
+	return r->acc >> (64 - n);
+}
+
+static inline void br_skip(bitr_t *r, int n)
+{
+	r->acc <<= n;
+	r->n -= n;
+}
+
+/* bits taken from start, -1 if some of them were past the end */
+static long br_used(bitr_t *r, const uint8_t *start)
+{
+	if (r->n < r->over)
+		return -1;
+	return (r->p - start) * 8 - (r->n - r->over);
+}
+
+static uint32_t br_get(bitr_t *r, int n)
+{
+	if (n == 0)
+		return 0;
+	br_fill(r);
+	uint32_t v = br_peek(r, n);
+	br_skip(r, n);
+	return v;
+}
+
+static void put_gamma(bitw_t *w, uint32_t v)
+{
+	int n = 32 - __builtin_clz(v);
+	bw_put(w, 0, n - 1);
+	bw_put(w, v, n);
+}
+
+static uint32_t get_gamma(bitr_t *r)
+{
+	int n = 0;
+	while (br_get(r, 1) == 0)
+		if (++n > 16)
+			return 0;
+	return br_get(r, n) | (1 << n);
+}
+
+/* code lengths from the same list-built tree, then limited to MAXLEN */
+void huff_lengths(unsigned freq[256], uint8_t len[256])
+{
+	int np = 0, i, j;
+	node_t node_pool[511];
+	bzero(node_pool, sizeof(node_pool));
+	bzero(len, 256);
+
+	node_t *alloc_node(unsigned char v, unsigned int freq, node_t *left, node_t *right) {
+		node_t *r = &node_pool[np++];
+		r->v = v;
+		r->freq = freq;
+		r->left = left;
+		r->right = right;
+		return r;
+	}
+	node_t *insert(node_t *list, node_t *node) {
+		node_t **p = &list;
+		while (*p && (*p)->freq <= node->freq)
+			p = &(*p)->next;
+		node->next = *p;
+		*p = node;
+		return list;
+	}
+	node_t *list = NULL;
+	for (i = 0; i < 256; i++)
+		if (freq[i])
+			list = insert(list, alloc_node(i, freq[i], NULL, NULL));
+	/* single symbol has no code at all */
+	if (list == NULL || list->next == NULL)
+		return;
+	while (list->next) {
+		node_t *left = list, *right = list->next;
+		list = insert(right->next, alloc_node(0, left->freq + right->freq, left, right));
+	}
+
+	int count[256];
+	bzero(count, sizeof(count));
+	void depth(node_t *n, int d) {
+		if (n->left == NULL) {
+			len[n->v] = d;
+			count[d > MAXLEN ? MAXLEN : d]++;
+		} else {
+			depth(n->left, d + 1);
+			depth(n->right, d + 1);
+		}
+	}
+	depth(list, 0);
+
+	/* clamp and repair Kraft sum, moving leaves down (miniz trick) */
+	uint32_t total = 0;
+	for (i = 1; i <= MAXLEN; i++)
+		total += count[i] << (MAXLEN - i);
+	if (total == (1U << MAXLEN))
+		return;
+	while (total != (1U << MAXLEN)) {
+		count[MAXLEN]--;
+		for (i = MAXLEN - 1; i > 0; i--)
+			if (count[i]) {
+				count[i]--;
+				count[i + 1] += 2;
+				break;
+			}
+		total--;
+	}
+	/* hand out new lengths, shortest to the most frequent */
+	int sym[256], n = 0;
+	for (i = 0; i < 256; i++)
+		if (freq[i]) {
+			for (j = n++; j > 0 && freq[sym[j - 1]] < freq[i]; j--)
+				sym[j] = sym[j - 1];
+			sym[j] = i;
+		}
+	for (i = 1, j = 0; i <= MAXLEN; i++)
+		while (count[i]--)
+			len[sym[j++]] = i;
+}
+
+/* canonical codes, assigned in (length, symbol) order */
+void huff_codes(uint8_t len[256], uint16_t code[256])
+{
+	int i, c = 0, count[MAXLEN + 1], next[MAXLEN + 1];
+	bzero(count, sizeof(count));
+	for (i = 0; i < 256; i++)
+		count[len[i]]++;
+	count[0] = 0;
+	for (i = 1; i <= MAXLEN; i++) {
+		c = (c + count[i - 1]) << 1;
+		next[i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		if (len[i])
+			code[i] = next[len[i]]++;
+}
+
+/*
+header: 8 bits number of symbols - 1
+	one symbol (or none): 8 bits symbol
+	otherwise: 4 bits max length, then for each used symbol
+	gamma(gap + 1) and length - 1 in just enough bits for max length
+*/
+static void put_header(bitw_t *w, uint8_t len[256], unsigned freq[256])
+{
+	int i, n = 0, max = 0, prev = -1;
+	for (i = 0; i < 256; i++)
+		if (freq[i]) {
+			n++;
+			if (len[i] > max)
+				max = len[i];
+		}
+	/* empty input is sent as one symbol, 0 */
+	bw_put(w, n ? n - 1 : 0, 8);
+	if (n <= 1) {
+		for (i = 0; n && !freq[i]; i++)
+			;
+		bw_put(w, i, 8);
+		return;
+	}
+	int lb = max > 1 ? 32 - __builtin_clz(max - 1) : 0;
+	bw_put(w, max, 4);
+	for (i = 0; i < 256; i++)
+		if (len[i]) {
+			put_gamma(w, i - prev);
+			bw_put(w, len[i] - 1, lb);
+			prev = i;
+		}
+}
+
+/* returns number of symbols, single symbol is returned in *sym, -1 if bad or past the end */
+static int get_header(bitr_t *r, uint8_t len[256], int *sym)
+{
+	int i, n = br_get(r, 8) + 1, prev = -1;
+	bzero(len, 256);
+	if (n == 1) {
+		*sym = br_get(r, 8);
+		return r->n < r->over ? -1 : 1;
+	}
+	int max = br_get(r, 4);
+	if (max == 0 || max > MAXLEN)
+		return -1;
+	int lb = max > 1 ? 32 - __builtin_clz(max - 1) : 0;
+	for (i = 0; i < n; i++) {
+		int g = get_gamma(r);
+		if (g == 0 || (prev += g) > 255)
+			return -1;
+		len[prev] = br_get(r, lb) + 1;
+		if (len[prev] > max)
+			return -1;
+	}
+	return r->n < r->over ? -1 : n;
+}
+
+/* decoding table: symbol | length << 8, indexed by next MAXLEN bits */
+static int build_table(uint8_t len[256], uint16_t dt[1 << MAXLEN])
+{
+	uint16_t code[256];
+	uint32_t total = 0;
+	int i, j;
+	for (i = 0; i < 256; i++)
+		if (len[i])
+			total += 1 << (MAXLEN - len[i]);
+	if (total != (1 << MAXLEN))
+		return -1;
+	huff_codes(len, code);
+	for (i = 0; i < 256; i++)
+		if (len[i]) {
+			int k = code[i] << (MAXLEN - len[i]);
+			for (j = 0; j < (1 << (MAXLEN - len[i])); j++)
+				dt[k + j] = i | len[i] << 8;
+		}
+	return 0;
+}
+
+int encode_canon(uint8_t *out, uint8_t *in, int l)
+{
+	int i;
+	unsigned freq[256];
+	uint8_t len[256];
+	uint16_t code[256];
+	bitw_t w = { out, 0, 0 };
+
+	count(freq, in, l);
+	huff_lengths(freq, len);
+	huff_codes(len, code);
+	put_header(&w, len, freq);
+	for (i = 0; i < l; i++)
+		bw_put(&w, code[in[i]], len[in[i]]);
+	return bw_flush(&w) - out;
+}
+
+#define	DECODE1(r, o) do {				\
+	uint16_t e = dt[br_peek(&(r), MAXLEN)];		\
+	br_skip(&(r), e >> 8);				\
+	*(o)++ = e;					\
+} while (0)
+
+/* 56 bits after refill are enough for five symbols */
+static void decode_run(bitr_t *r, uint16_t *dt, uint8_t *out, int l)
+{
+	uint8_t *end = out + l;
+	while (end - out >= 5) {
+		br_fill(r);
+		DECODE1(*r, out);
+		DECODE1(*r, out);
+		DECODE1(*r, out);
+		DECODE1(*r, out);
+		DECODE1(*r, out);
+	}
+	while (out < end) {
+		br_fill(r);
+		DECODE1(*r, out);
+	}
+}
+
+int decode_canon(uint8_t *out, int l, uint8_t *in, int il)
+{
+	uint8_t len[256];
+	uint16_t dt[1 << MAXLEN];
+	bitr_t r = { in, in + il, 0, 0 };
+	int sym;
+
+	int n = get_header(&r, len, &sym);
+	if (n < 0)
+		return -1;
+	if (n == 1) {
+		memset(out, sym, l);
+		return 0;
+	}
+	if (build_table(len, dt) < 0)
+		return -1;
+	decode_run(&r, dt, out, l);
+	return 0;
+}
+
+/*
+Four interleaved streams. With one bitstream the position of the next code
+is known only after the previous one is decoded, so the loop is one long
+dependency chain. Split the block into four quarters, encode each into its
+own stream and put the sizes of the first three in front (3 x 16 bits, so
+the block is limited to BLOCK bytes). Decoder runs four chains at once.
+*/
+#define	BLOCK	(128 << 10)
+/* worst case of any encoder for a block, rANS may spend 12 bits per byte */
+#define	OBOUND	(BLOCK * 2)
+
+static void put16(uint8_t *p, unsigned v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static unsigned get16(uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static uint32_t get32(uint8_t *p)
+{
+	return get16(p) | get16(p + 2) << 16;
+}
+
+int encode_canon4(uint8_t *out, uint8_t *in, int l)
+{
+	int i, k, seg = (l + 3) / 4;
+	unsigned freq[256];
+	uint8_t len[256];
+	uint16_t code[256];
+	bitw_t w = { out, 0, 0 };
+
+	assert(l <= BLOCK);
+	count(freq, in, l);
+	huff_lengths(freq, len);
+	huff_codes(len, code);
+	put_header(&w, len, freq);
+	uint8_t *jt = bw_flush(&w);
+	w.p = jt + 6;
+	for (k = 0; k < 4; k++) {
+		uint8_t *start = w.p;
+		int end = (k + 1) * seg < l ? (k + 1) * seg : l;
+		for (i = k * seg; i < end; i++)
+			bw_put(&w, code[in[i]], len[in[i]]);
+		bw_flush(&w);
+		if (k < 3)
+			put16(jt + k * 2, w.p - start);
+	}
+	return w.p - out;
+}
+
+int decode_canon4(uint8_t *out, int l, uint8_t *in, int il)
+{
+	uint8_t len[256];
+	uint16_t dt[1 << MAXLEN];
+	bitr_t r = { in, in + il, 0, 0 };
+	int sym, i, seg = (l + 3) / 4;
+
+	int n = get_header(&r, len, &sym);
+	if (n < 0)
+		return -1;
+	if (n == 1) {
+		memset(out, sym, l);
+		return 0;
+	}
+	if (build_table(len, dt) < 0)
+		return -1;
+
+	/* header is byte aligned */
+	uint8_t *jt = in + (br_used(&r, in) + 7) / 8, *p = jt + 6, *end = in + il;
+	if (end - jt < 6)
+		return -1;
+	bitr_t s[4];
+	for (i = 0; i < 4; i++) {
+		unsigned sz = i < 3 ? get16(jt + i * 2) : end - p;
+		if (p > end || sz > end - p)
+			return -1;
+		s[i] = (bitr_t){ p, p + sz, 0, 0 };
+		p += sz;
+	}
+	uint8_t *o0 = out, *o1 = out + seg, *o2 = out + 2 * seg, *o3 = out + 3 * seg;
+	int last = l - 3 * seg;
+	if (last > 0) {
+		/* stream 3 is the shortest, all four decode in lockstep */
+		for (i = 0; i + 5 <= last; i += 5) {
+			br_fill(&s[0]);
+			br_fill(&s[1]);
+			br_fill(&s[2]);
+			br_fill(&s[3]);
+			for (int k = 0; k < 5; k++) {
+				DECODE1(s[0], o0);
+				DECODE1(s[1], o1);
+				DECODE1(s[2], o2);
+				DECODE1(s[3], o3);
+			}
+		}
+		decode_run(&s[3], dt, o3, last - i);
+	} else
+		i = 0;
+	for (int k = 0; k < 3; k++) {
+		int cnt = l - k * seg < seg ? l - k * seg : seg;
+		if (cnt > i)
+			decode_run(&s[k], dt, out + k * seg + i, cnt - i);
+	}
+	return 0;
+}
+
+/*
+rANS. Huffman codes are whole bits, so a symbol with p = 0.9 still costs one
+bit instead of 0.15. Asymmetric numeral systems keep the fraction in the
+state x: with frequencies f[s] scaled to sum to 1 << PROB_BITS, encoding s is
+
+	x = (x / f[s]) << PROB_BITS + x % f[s] + start[s]
+
+and 16-bit words are shifted out to keep x in [L, L << 16). One word is
+always enough, so the decoder renormalizes without a branch. Decoder runs it
+backwards, so encoder goes from the last symbol to the first and writes the
+output from the end. Slot x & (M - 1) gives the symbol by table lookup.
+Two states interleaved (even and odd symbols), for the same reason as the
+four Huffman streams. Frequencies are sent as in the canonical header, the
+last one is implied.
+*/
+#define	PROB_BITS	12
+#define	RANS_L		(1U << 16)
+
+/* scale to 1 << PROB_BITS, keep every used symbol at least 1 */
+static void rans_norm(unsigned freq[256], int l, unsigned f[256])
+{
+	int i, max = 0, sum = 0;
+	for (i = 0; i < 256; i++) {
+		f[i] = freq[i] ? (uint64_t)freq[i] * (1 << PROB_BITS) / l : 0;
+		if (freq[i] && f[i] == 0)
+			f[i] = 1;
+		if (f[i] > f[max])
+			max = i;
+		sum += f[i];
+	}
+	if (sum <= (1 << PROB_BITS)) {
+		f[max] += (1 << PROB_BITS) - sum;
+		return;
+	}
+	/* too many ones, take from the largest */
+	while (sum > (1 << PROB_BITS)) {
+		for (max = 0, i = 1; i < 256; i++)
+			if (f[i] > f[max])
+				max = i;
+		int d = sum - (1 << PROB_BITS), a = f[max] / 2;
+		d = d < a ? d : a;
+		f[max] -= d;
+		sum -= d;
+	}
+}
+
+int encode_rans(uint8_t *out, uint8_t *in, int l)
+{
+	unsigned freq[256], f[256], start[256];
+	int i, n = 0, last = -1, prev = -1;
+	bitw_t w = { out, 0, 0 };
+
+	count(freq, in, l);
+	for (i = 0; i < 256; i++)
+		if (freq[i]) {
+			n++;
+			last = i;
+		}
+	/* empty input as one symbol, 0, as in put_header() */
+	bw_put(&w, n ? n - 1 : 0, 8);
+	if (n <= 1) {
+		bw_put(&w, n ? last : 0, 8);
+		return bw_flush(&w) - out;
+	}
+	rans_norm(freq, l, f);
+	for (i = 0; i < 256; i++)
+		if (f[i]) {
+			put_gamma(&w, i - prev);
+			if (i != last)
+				put_gamma(&w, f[i]);
+			prev = i;
+		}
+	uint8_t *hdr = bw_flush(&w);
+	for (i = 0, n = 0; i < 256; n += f[i++])
+		start[i] = n;
+
+	/* from the end of the output space, moved down afterwards */
+	uint8_t *end = out + OBOUND, *p = end;
+	uint32_t x[2] = { RANS_L, RANS_L };
+	for (i = l - 1; i >= 0; i--) {
+		unsigned s = in[i], k = i & 1;
+		if (x[k] >= ((RANS_L >> PROB_BITS) << 16) * f[s]) {
+			p -= 2;
+			put16(p, x[k]);
+			x[k] >>= 16;
+		}
+		x[k] = ((x[k] / f[s]) << PROB_BITS) + x[k] % f[s] + start[s];
+	}
+	for (i = 1; i >= 0; i--) {
+		p -= 4;
+		put32(p, x[i]);
+	}
+	memmove(hdr, p, end - p);
+	return hdr + (end - p) - out;
+}
+
+int decode_rans(uint8_t *out, int l, uint8_t *in, int il)
+{
+	unsigned f[256];
+	uint32_t tab[1 << PROB_BITS];
+	bitr_t r = { in, in + il, 0, 0 };
+	int i, j, n, sym = -1, sum = 0;
+
+	n = br_get(&r, 8) + 1;
+	if (n == 1) {
+		sym = br_get(&r, 8);
+		if (r.n < r.over)
+			return -1;
+		memset(out, sym, l);
+		return 0;
+	}
+	bzero(f, sizeof(f));
+	for (i = 0; i < n; i++) {
+		int g = get_gamma(&r);
+		if (g == 0 || (sym += g) > 255)
+			return -1;
+		f[sym] = i < n - 1 ? get_gamma(&r) : (1 << PROB_BITS) - sum;
+		sum += f[sym];
+		if (f[sym] == 0 || f[sym] >= (1 << PROB_BITS))
+			return -1;
+	}
+	/* slot -> symbol | (slot - start) << 8 | freq << 20 */
+	for (i = 0, n = 0; i < 256; i++)
+		for (j = 0; j < f[i]; j++, n++)
+			tab[n] = i | j << 8 | f[i] << 20;
+
+	/* header past the end, or no room for the two states */
+	long used = br_used(&r, in);
+	if (used < 0)
+		return -1;
+	uint8_t *p = in + (used + 7) / 8, *end = in + il;
+	if (end - p < 8)
+		return -1;
+	uint32_t x0 = get32(p), x1 = get32(p + 4);
+	p += 8;
+#define	RANS_DEC(x, next) do {						\
+	uint32_t e = tab[x & ((1 << PROB_BITS) - 1)];			\
+	*out++ = e;							\
+	x = (e >> 20) * (x >> PROB_BITS) + ((e >> 8) & 0xfff);		\
+	int m = x < RANS_L;						\
+	x = m ? x << 16 | next : x;					\
+	p += m * 2;							\
+} while (0)
+	uint8_t *oend = out + l;
+	/* no bound checks while there are 4 bytes for two symbols */
+	while (oend - out >= 2 && end - p >= 4) {
+		RANS_DEC(x0, get16(p));
+		RANS_DEC(x1, get16(p));
+	}
+	while (out < oend) {
+		RANS_DEC(x0, (end - p >= 2 ? get16(p) : 0));
+		if (out < oend)
+			RANS_DEC(x1, (end - p >= 2 ? get16(p) : 0));
+	}
+	return 0;
+}
+
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* single vs. four streams vs. rANS on a large input, block by block */
+int bench(char *name)
+{
+	size_t s = 64 << 20, i, j;
+	uint8_t *in;
+	if (name) {
+		FILE *f = fopen(name, "rb");
+		if (f == NULL) {
+			printf("Failed to open %s\n", name);
+			return 2;
+		}
+		fseek(f, 0, SEEK_END);
+		s = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		in = malloc(s);
+		assert(in != NULL);
+		if (fread(in, 1, s, f) != s)
+			return 2;
+		fclose(f);
+	} else {
+		/* skewed alphabet, about 2 bits per symbol */
+		in = malloc(s);
+		assert(in != NULL);
+		for (i = 0; i < s; i++)
+			in[i] = 'a' + __builtin_ctz(random() | 1 << 24);
+	}
+	size_t nb = (s + BLOCK - 1) / BLOCK;
+	uint8_t *o = malloc(nb * OBOUND), *t = malloc(s);
+	int *osz = malloc(nb * sizeof(int));
+	assert(o != NULL && t != NULL && osz != NULL);
+
+	struct {
+		char *name;
+		int (*enc)(uint8_t *, uint8_t *, int);
+		int (*dec)(uint8_t *, int, uint8_t *, int);
+	} fmt[] = {
+		{ "1 stream ", encode_canon, decode_canon },
+		{ "4 streams", encode_canon4, decode_canon4 },
+		{ "rANS     ", encode_rans, decode_rans },
+	};
+	printf("Input %zu bytes, %zu blocks\n", s, nb);
+	for (int f = 0; f < 3; f++) {
+		size_t total = 0;
+		double t0 = now();
+		for (i = 0; i < nb; i++) {
+			int l = i < nb - 1 ? BLOCK : s - i * BLOCK;
+			osz[i] = fmt[f].enc(o + i * OBOUND, in + i * BLOCK, l);
+			total += osz[i];
+		}
+		double te = now() - t0;
+		int reps = 8;
+		t0 = now();
+		for (j = 0; j < reps; j++)
+			for (i = 0; i < nb; i++) {
+				int l = i < nb - 1 ? BLOCK : s - i * BLOCK;
+				fmt[f].dec(t + i * BLOCK, l, o + i * OBOUND, osz[i]);
+			}
+		double td = (now() - t0) / reps;
+		assert(memcmp(in, t, s) == 0);
+		printf("%s %zu bytes (%.2f bits/byte) encode %.1f MB/s decode %.1f MB/s\n",
+			fmt[f].name, total, total * 8.0 / s, s / te / 1e6, s / td / 1e6);
+	}
+	return 0;
+}
+
+/*
+Block container for files. Input is cut into BLOCK sized blocks, each one
+has its own table and is stored as
+
+	type (1)	0 stored, 1 one stream, 2 four streams, 3 rANS
+	raw size (4)
+	coded size (4)
+	adler32 of the raw data (4)
+	payload
+
+all little endian. Blocks are independent, so a batch of them is coded on
+a pool of threads, and written out in order. Memory is bounded by batch.
+*/
+#define	B_STORED	0
+#define	B_HUF1		1
+#define	B_HUF4		2
+#define	B_RANS		3
+#define	B_AUTO		0x80	/* try rANS too, keep the smaller */
+#define	BHDR		13
+#define	BATCH		4	/* blocks per thread */
+
+uint32_t adler32(uint8_t *p, int l)
+{
+	uint32_t a = 1, b = 0;
+	while (l > 0) {
+		int n = l < 5552 ? l : 5552;
+		l -= n;
+		while (n--) {
+			a += *p++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return b << 16 | a;
+}
+
+struct job {
+	int type, l, ol, err;
+	uint32_t sum;
+	uint8_t *in, *out;
+};
+
+struct pool {
+	int nth, njobs, next, quit;
+	struct job *jobs;
+	void (*fn)(struct job *);
+	pthread_mutex_t lock;	/* held until the barriers know nth */
+	pthread_barrier_t start, done;
+	pthread_t th[];
+};
+
+static void pool_work(struct pool *p)
+{
+	int i;
+	while ((i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) < p->njobs)
+		p->fn(&p->jobs[i]);
+}
+
+static void *worker(void *arg)
+{
+	struct pool *p = arg;
+	pthread_mutex_lock(&p->lock);
+	pthread_mutex_unlock(&p->lock);
+	for (;;) {
+		pthread_barrier_wait(&p->start);
+		if (p->quit)
+			return NULL;
+		pool_work(p);
+		pthread_barrier_wait(&p->done);
+	}
+}
+
+/* calling thread is one of the workers, threads that can't be started are left out */
+struct pool *pool_create(int nth)
+{
+	struct pool *p = calloc(1, sizeof(struct pool) + nth * sizeof(pthread_t));
+	assert(p != NULL);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_mutex_lock(&p->lock);
+	for (p->nth = 1; p->nth < nth; p->nth++)
+		if (pthread_create(&p->th[p->nth], NULL, worker, p) != 0)
+			break;
+	pthread_barrier_init(&p->start, NULL, p->nth);
+	pthread_barrier_init(&p->done, NULL, p->nth);
+	pthread_mutex_unlock(&p->lock);
+	return p;
+}
+
+void pool_run(struct pool *p, void (*fn)(struct job *), struct job *jobs, int njobs)
+{
+	p->fn = fn;
+	p->jobs = jobs;
+	p->njobs = njobs;
+	p->next = 0;
+	pthread_barrier_wait(&p->start);
+	pool_work(p);
+	pthread_barrier_wait(&p->done);
+}
+
+void pool_destroy(struct pool *p)
+{
+	p->quit = 1;
+	pthread_barrier_wait(&p->start);
+	for (int i = 1; i < p->nth; i++)
+		pthread_join(p->th[i], NULL);
+	pthread_barrier_destroy(&p->start);
+	pthread_barrier_destroy(&p->done);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+}
+
+static int encode_block(int type, uint8_t *out, uint8_t *in, int l)
+{
+	switch (type) {
+	case B_HUF4:
+		return encode_canon4(out, in, l);
+	case B_RANS:
+		return encode_rans(out, in, l);
+	default:
+		return encode_canon(out, in, l);
+	}
+}
+
+static void compress_block(struct job *j)
+{
+	j->sum = adler32(j->in, j->l);
+	j->ol = encode_block(j->type & ~B_AUTO, j->out, j->in, j->l);
+	if (j->type & B_AUTO) {
+		j->type &= ~B_AUTO;
+		int ol = encode_rans(j->out + OBOUND, j->in, j->l);
+		if (ol < j->ol) {
+			memcpy(j->out, j->out + OBOUND, ol);
+			j->ol = ol;
+			j->type = B_RANS;
+		}
+	}
+	if (j->ol >= j->l) {
+		j->type = B_STORED;
+		j->ol = j->l;
+		memcpy(j->out, j->in, j->l);
+	}
+}
+
+static void decompress_block(struct job *j)
+{
+	switch (j->type) {
+	case B_STORED:
+		if (j->ol != j->l)
+			j->err = 1;
+		else
+			memcpy(j->out, j->in, j->l);
+		break;
+	case B_HUF1:
+		j->err = decode_canon(j->out, j->l, j->in, j->ol) < 0;
+		break;
+	case B_HUF4:
+		j->err = decode_canon4(j->out, j->l, j->in, j->ol) < 0;
+		break;
+	case B_RANS:
+		j->err = decode_rans(j->out, j->l, j->in, j->ol) < 0;
+		break;
+	default:
+		j->err = 1;
+	}
+	if (j->err == 0 && adler32(j->out, j->l) != j->sum)
+		j->err = 1;
+}
+
+int compress(FILE *fi, FILE *fo, int nth, int type)
+{
+	int i, n, nb = nth * BATCH;
+	struct job jobs[nb];
+	/* second half of the output is scratch for B_AUTO */
+	uint8_t *ibuf = malloc((size_t)nb * BLOCK), *obuf = malloc((size_t)nb * OBOUND * 2);
+	assert(ibuf != NULL && obuf != NULL);
+	struct pool *p = pool_create(nth);
+	do {
+		for (n = 0; n < nb; n++) {
+			jobs[n] = (struct job){ type, 0, 0, 0, 0, ibuf + n * BLOCK, obuf + (size_t)n * OBOUND * 2 };
+			jobs[n].l = fread(jobs[n].in, 1, BLOCK, fi);
+			if (jobs[n].l == 0)
+				break;
+		}
+		pool_run(p, compress_block, jobs, n);
+		for (i = 0; i < n; i++) {
+			uint8_t h[BHDR];
+			h[0] = jobs[i].type;
+			put32(h + 1, jobs[i].l);
+			put32(h + 5, jobs[i].ol);
+			put32(h + 9, jobs[i].sum);
+			fwrite(h, 1, BHDR, fo);
+			fwrite(jobs[i].out, 1, jobs[i].ol, fo);
+		}
+	} while (n == nb);
+	pool_destroy(p);
+	free(ibuf);
+	free(obuf);
+	return ferror(fi) || ferror(fo) ? 2 : 0;
+}
+
+int decompress(FILE *fi, FILE *fo, int nth)
+{
+	int i, n, nb = nth * BATCH, r = 0;
+	struct job jobs[nb];
+	uint8_t *ibuf = malloc((size_t)nb * OBOUND), *obuf = malloc((size_t)nb * BLOCK);
+	assert(ibuf != NULL && obuf != NULL);
+	struct pool *p = pool_create(nth);
+	do {
+		for (n = 0; n < nb; n++) {
+			uint8_t h[BHDR];
+			size_t hl = fread(h, 1, BHDR, fi);
+			if (hl == 0)
+				break;
+			uint32_t l = get32(h + 1), ol = get32(h + 5);
+			if (hl != BHDR || l == 0 || l > BLOCK || ol > OBOUND ||
+			    fread(ibuf + (size_t)n * OBOUND, 1, ol, fi) != ol) {
+				fprintf(stderr, "Truncated or corrupt block header\n");
+				r = 1;
+				break;
+			}
+			jobs[n] = (struct job){ h[0], l, ol, 0, get32(h + 9), ibuf + (size_t)n * OBOUND, obuf + n * BLOCK };
+		}
+		pool_run(p, decompress_block, jobs, n);
+		for (i = 0; i < n; i++) {
+			if (jobs[i].err) {
+				fprintf(stderr, "Bad block %d\n", i);
+				r = 1;
+				break;
+			}
+			fwrite(jobs[i].out, 1, jobs[i].l, fo);
+		}
+	} while (n == nb && r == 0);
+	pool_destroy(p);
+	free(ibuf);
+	free(obuf);
+	return r ? r : ferror(fi) || ferror(fo) ? 2 : 0;
+}
+
 int main(int argc, char **argv)
 {
+	int opt, mode = 0, nth = 1, type = B_HUF1;
 	srandom(time(NULL));
+	while ((opt = getopt(argc, argv, "bcd4aAt:")) != -1)
+		switch (opt) {
+		case 'b':
+		case 'c':
+		case 'd':
+			mode = opt;
+			break;
+		case '4':
+			type = (type & B_AUTO) | B_HUF4;
+			break;
+		case 'a':
+			type = B_RANS;
+			break;
+		case 'A':
+			type = (type == B_HUF4 ? B_HUF4 : B_HUF1) | B_AUTO;
+			break;
+		case 't':
+			nth = atoi(optarg);
+			if (nth < 1)
+				nth = 1;
+			break;
+		default:
+			printf("Usage: %s string\n"
+				"       %s -b [file]\n"
+				"       %s -c|-d [-4|-a|-A] [-t threads] [in [out]]\n", argv[0], argv[0], argv[0]);
+			return 2;
+		}
+	if (mode == 'b')
+		return bench(argv[optind]);
+	if (mode) {
+		FILE *fi = stdin, *fo = stdout;
+		if (optind < argc && (fi = fopen(argv[optind], "rb")) == NULL) {
+			perror(argv[optind]);
+			return 2;
+		}
+		if (optind + 1 < argc && (fo = fopen(argv[optind + 1], "wb")) == NULL) {
+			perror(argv[optind + 1]);
+			return 2;
+		}
+		int r = mode == 'c' ? compress(fi, fo, nth, type) : decompress(fi, fo, nth);
+		fclose(fi);
+		fclose(fo);
+		return r;
+	}
+	if (optind >= argc)
+		return 2;
+
 	int s, k, j, x;
-	uint8_t *i = strdup(argv[1]);
+	uint8_t *i = strdup(argv[optind]);
 	s = strlen(i);
-	uint8_t *o = malloc(s * 2);
+	uint8_t *o = malloc(s * 2 + OBOUND);
 	uint8_t *t = malloc(s);
 
 	printf("Input:\n%s\nLen: %d\n", i, s);
@@ -229,4 +1214,24 @@ int main(int argc, char **argv)
 		decode(t, o, s);
 		assert(memcmp(t, i, s) == 0);
 	}
+
+	/* the same, but with canonical header */
+	int c = encode_canon(o, i, s);
+	printf("Canonical len: %d\n", c);
+	for (j = 0; j < c; j++)
+		printf("%02x", o[j]);
+	puts("");
+	x = decode_canon(t, s, o, c);
+	assert(x == 0);
+	assert(memcmp(t, i, s) == 0);
+	c = encode_canon4(o, i, s);
+	printf("4 streams len: %d\n", c);
+	x = decode_canon4(t, s, o, c);
+	assert(x == 0);
+	assert(memcmp(t, i, s) == 0);
+	c = encode_rans(o, i, s);
+	printf("rANS len: %d\n", c);
+	x = decode_rans(t, s, o, c);
+	assert(x == 0);
+	assert(memcmp(t, i, s) == 0);
 }
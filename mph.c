@@ -0,0 +1,353 @@
+/*
+Minimal perfect hash over a set of names (BDZ)
+
+randbloom.c tells whether a name is in the set, but to map a name to its
+index (a slot in an import table) we need a perfect hash. A random hash
+without collisions on 2.7k names is a 32-bit search, and the table is
+still n words. BDZ (Botelho, Pagh, Ziviani, "Simple and space-efficient
+minimal perfect hash functions", 2007) does it in ~2.6 bits per key:
+
+Every key is an edge between three vertices, one in each third of a
+table of 1.23n. Vertices with a single edge are peeled off together with
+their edge, until no edges are left (or retry with another seed, when
+there's a 2-core). Then in reverse order, every edge gets to choose its
+free vertex i: g[v] = (i - g[u] - g[w]) mod 3, so for every key
+
+	(g[v0] + g[v1] + g[v2]) mod 3
+
+tells which of its three vertices is its own, and no two keys share one.
+g is 2 bits, unused vertices are 3 (which is 0 mod 3). The vertex is
+turned into 0..n-1 by counting used vertices before it: 32 vertices per
+word, a 32-bit count every 256 (8 words), 0.15 bits per key.
+
+Names not in the set get some index too, keep the names or a fingerprint
+to reject them.
+
+./mph [-l list] [-E elf] [-o file] [-i file]
+
+-o writes the table, -i reads one and checks it against the names
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "strset.h"
+
+struct mph {
+	uint64_t seed;
+	uint32_t n, r;		/* keys, vertices per third */
+	uint64_t *g;		/* 2 bits per vertex */
+	uint32_t *rank;		/* used vertices before every 256 */
+};
+
+#define	NV(m)		(3 * (m)->r)
+#define	GWORDS(m)	((NV(m) + 255) / 256 * 8)	/* whole blocks */
+#define	NRANK(m)	(NV(m) / 256 + 1)
+
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline uint64_t mix64(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* 8 bytes per step, strings are short */
+static inline uint64_t strhash(const char *s, int len, uint64_t seed)
+{
+	uint64_t h = seed ^ (len * 0x9E3779B97F4A7C15ULL), w;
+	for (; len >= 8; len -= 8, s += 8) {
+		memcpy(&w, s, 8);
+		h = (h ^ w) * 0x87c37b91114253d5ULL;
+		h = h << 31 | h >> 33;
+	}
+	for (w = 0; len--; )
+		w = w << 8 | (uint8_t)s[len];
+	return mix64(h ^ w);
+}
+
+static inline void edge(const struct mph *m, uint64_t x, uint32_t v[3])
+{
+	v[0] = ((uint64_t)(uint32_t)x * m->r) >> 32;
+	v[1] = m->r + (((x >> 32) * m->r) >> 32);
+	v[2] = 2 * m->r + (((mix64(x) & 0xffffffff) * m->r) >> 32);
+}
+
+static inline unsigned gget(const uint64_t *g, uint32_t v)
+{
+	return (g[v / 32] >> (v % 32 * 2)) & 3;
+}
+
+/* 3s in w, per byte */
+static inline uint64_t threes(uint64_t w)
+{
+	uint64_t t = w & (w >> 1) & 0x5555555555555555ULL;
+	t = (t & 0x3333333333333333ULL) + ((t >> 2) & 0x3333333333333333ULL);
+	return (t + (t >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+}
+
+/* used (not 3) vertices in w */
+static inline int used(uint64_t w)
+{
+	return 32 - ((threes(w) * 0x0101010101010101ULL) >> 56);
+}
+
+/*
+The block is always 8 words and the fields from x on are cleared, without
+branches the count takes the same time for every key.
+*/
+static inline uint32_t mph_lookup(const struct mph *m, const char *s, int len)
+{
+	uint32_t v[3];
+	edge(m, strhash(s, len, m->seed), v);
+	uint32_t x = v[(gget(m->g, v[0]) + gget(m->g, v[1]) + gget(m->g, v[2])) % 3];
+	const uint64_t *g = m->g + x / 256 * 8;
+	uint32_t k = x % 256, wi = k / 32, w;
+	uint64_t t = threes(g[wi] & ((1ULL << (k % 32 * 2)) - 1));
+	for (w = 0; w < 8; w++)
+		t += threes(g[w] & -(uint64_t)(w < wi));
+	return m->rank[x / 256] + k - ((t * 0x0101010101010101ULL) >> 56);
+}
+
+/* 0 or -1 when no seed gives an acyclic graph */
+int mph_build(struct mph *m, char **s, int *len, uint32_t n)
+{
+	uint32_t i, v[3], nv, tries;
+	m->n = n;
+	m->r = (n * 123ULL / 100 + 2) / 3 + 1;
+	nv = NV(m);
+	uint8_t *deg = malloc(nv);
+	uint32_t *xe = malloc(nv * sizeof(uint32_t)), *queue = malloc(nv * sizeof(uint32_t));
+	uint32_t *order = malloc((n + 1) * sizeof(uint32_t));
+	uint8_t *which = malloc(n + 1);
+	uint64_t *x = malloc((n + 1) * sizeof(uint64_t));
+	m->g = malloc(GWORDS(m) * sizeof(uint64_t));
+	m->rank = malloc(NRANK(m) * sizeof(uint32_t));
+	assert(deg && xe && queue && order && which && x && m->g && m->rank);
+
+	for (tries = 0; tries < 64; tries++) {
+		m->seed = mix64(tries + 0x6d7068);
+		memset(deg, 0, nv);
+		memset(xe, 0, nv * sizeof(uint32_t));
+		for (i = 0; i < n; i++) {
+			x[i] = strhash(s[i], len[i], m->seed);
+			edge(m, x[i], v);
+			/* degree in steps of 4, low bits xor the position, as in the fuse filter */
+			for (int j = 0; j < 3; j++) {
+				if (deg[v[j]] >= 252)
+					goto retry;
+				deg[v[j]] = (deg[v[j]] + 4) ^ j;
+				xe[v[j]] ^= i;
+			}
+		}
+		uint32_t q = 0, top = 0;
+		for (i = 0; i < nv; i++)
+			if (deg[i] >> 2 == 1)
+				queue[q++] = i;
+		while (q) {
+			uint32_t k = queue[--q], e;
+			if (deg[k] >> 2 != 1)
+				continue;
+			e = xe[k];
+			which[top] = deg[k] & 3;
+			order[top++] = e;
+			edge(m, x[e], v);
+			for (int j = 0; j < 3; j++) {
+				deg[v[j]] = (deg[v[j]] - 4) ^ j;
+				xe[v[j]] ^= e;
+				if (v[j] != k && deg[v[j]] >> 2 == 1)
+					queue[q++] = v[j];
+			}
+		}
+		if (top == n)
+			break;
+retry:		;
+	}
+	if (tries == 64)
+		return -1;
+
+	/* all 3, then assign in reverse */
+	memset(m->g, 0xff, GWORDS(m) * sizeof(uint64_t));
+	for (i = n; i--; ) {
+		uint32_t e = order[i], j = which[i];
+		edge(m, x[e], v);
+		unsigned a = (6 + j - gget(m->g, v[(j + 1) % 3]) % 3 - gget(m->g, v[(j + 2) % 3]) % 3) % 3;
+		m->g[v[j] / 32] &= ~(3ULL << (v[j] % 32 * 2));
+		m->g[v[j] / 32] |= (uint64_t)a << (v[j] % 32 * 2);
+	}
+	uint32_t r = 0;
+	for (i = 0; i < GWORDS(m); i++) {
+		if (i % 8 == 0)
+			m->rank[i / 8] = r;
+		/* the tail of the last block is 3 */
+		r += used(m->g[i]);
+	}
+	/* and all of them, when 3r ends a block there's a slot for it */
+	if (i / 8 < NRANK(m))
+		m->rank[i / 8] = r;
+	free(deg);
+	free(xe);
+	free(queue);
+	free(order);
+	free(which);
+	free(x);
+	return 0;
+}
+
+/*
+Serialised form, little endian, no pointers:
+
+	"BDZ1" n r seed64 g[(3r + 255) / 256 * 8] rank[3r / 256 + 1]
+*/
+int mph_save(const struct mph *m, const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return -1;
+	fwrite("BDZ1", 4, 1, f);
+	fwrite(&m->n, 4, 1, f);
+	fwrite(&m->r, 4, 1, f);
+	fwrite(&m->seed, 8, 1, f);
+	fwrite(m->g, 8, GWORDS(m), f);
+	fwrite(m->rank, 4, NRANK(m), f);
+	return fclose(f);
+}
+
+int mph_load(struct mph *m, const char *path)
+{
+	char magic[4];
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return -1;
+	if (fread(magic, 4, 1, f) != 1 || memcmp(magic, "BDZ1", 4) || fread(&m->n, 4, 1, f) != 1 ||
+	    fread(&m->r, 4, 1, f) != 1 || fread(&m->seed, 8, 1, f) != 1 || m->r == 0 || m->r > (1U << 30))
+		goto fail;
+	m->g = malloc(GWORDS(m) * sizeof(uint64_t));
+	m->rank = malloc(NRANK(m) * sizeof(uint32_t));
+	assert(m->g != NULL && m->rank != NULL);
+	if (fread(m->g, 8, GWORDS(m), f) != GWORDS(m) || fread(m->rank, 4, NRANK(m), f) != NRANK(m))
+		goto fail;
+	fclose(f);
+	return 0;
+fail:
+	fclose(f);
+	return -1;
+}
+
+size_t mph_bytes(const struct mph *m)
+{
+	return 4 + 4 + 4 + 8 + GWORDS(m) * 8 + NRANK(m) * 4;
+}
+
+/* every name to a distinct index below n */
+int verify(const struct mph *m, struct strset *ss)
+{
+	uint8_t *seen = calloc(ss->n, 1);
+	int bad = 0;
+	assert(seen != NULL);
+	for (int i = 0; i < ss->n; i++) {
+		uint32_t x = mph_lookup(m, ss->s[i], ss->len[i]);
+		if (x >= (uint32_t)ss->n || seen[x]++)
+			bad++;
+	}
+	free(seen);
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	struct strset ss;
+	struct mph m;
+	char *out = NULL, *in = NULL;
+	int opt, i;
+
+	strset_init(&ss);
+	while ((opt = getopt(argc, argv, "l:E:o:i:")) != -1)
+		switch (opt) {
+		case 'l':
+			if (strset_load_list(&ss, optarg) < 0) {
+				perror(optarg);
+				return 2;
+			}
+			break;
+		case 'E':
+			if (strset_load_elf(&ss, optarg) < 0) {
+				perror(optarg);
+				return 2;
+			}
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'i':
+			in = optarg;
+			break;
+		default:
+			printf("Usage: %s [-l list] [-E elf] [-o file] [-i file]\n", argv[0]);
+			return 2;
+		}
+	if (ss.n == 0 && strset_load_list(&ss, "list.txt") < 0) {
+		printf("Failed to open list.txt\n");
+		return 2;
+	}
+	i = strset_done(&ss);
+	assert(i == 0);
+
+	if (in) {
+		if (mph_load(&m, in) < 0) {
+			printf("Failed to read %s\n", in);
+			return 2;
+		}
+		if (m.n != (uint32_t)ss.n) {
+			printf("%s has %u keys, the set %d\n", in, m.n, ss.n);
+			return 1;
+		}
+	} else {
+		double t0 = now();
+		if (mph_build(&m, ss.s, ss.len, ss.n) < 0) {
+			printf("Failed to build\n");
+			return 1;
+		}
+		printf("%d keys, built in %.3f s\n", ss.n, now() - t0);
+	}
+	int bad = verify(&m, &ss);
+	printf("%zu bytes, %.2f bits/key, %d bad\n", mph_bytes(&m), mph_bytes(&m) * 8.0 / ss.n, bad);
+	if (bad)
+		return 1;
+
+	/* lookups in a shuffled order, so it's not just the next line */
+	int *perm = malloc(ss.n * sizeof(int)), reps = 1 + (1 << 24) / ss.n;
+	uint64_t rng = 88172645463325252ULL;
+	assert(perm != NULL);
+	for (i = 0; i < ss.n; i++)
+		perm[i] = i;
+	for (i = ss.n - 1; i > 0; i--) {
+		rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+		int j = rng % (i + 1), t = perm[i];
+		perm[i] = perm[j];
+		perm[j] = t;
+	}
+	uint32_t sum = 0;
+	double t0 = now();
+	for (int r = 0; r < reps; r++)
+		for (i = 0; i < ss.n; i++)
+			sum += mph_lookup(&m, ss.s[perm[i]], ss.len[perm[i]]);
+	double t = now() - t0;
+	printf("%.2f ns/lookup (%x)\n", t / reps / ss.n * 1e9, sum);
+
+	if (out && mph_save(&m, out) < 0) {
+		perror(out);
+		return 2;
+	}
+	return 0;
+}
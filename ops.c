@@ -44,16 +44,15 @@ int main(int argc, char **argv)
 	}
 	assert(init > 0 && fini > init);
 
-	/* disassemble and patch/read */
+	/* disassemble and patch/read, only lengths are needed */
 	int len = 0, count = 0;
 	unsigned char buf[1024];
 	bzero(buf, sizeof buf);
 	for (Elf64_Addr i = init; i < fini; i += len) {
-		hde64s hs;
-		len = hde64_disasm(m + i, &hs);
+		len = hde64_len(m + i);
 
-		/* reg/reg 2-byte opcodes */
-		if (hs.modrm_mod != 3 || len != 2)
+		/* reg/reg 2-byte opcodes, no prefix passes the test below, so m[i + 1] is ModRM */
+		if (len != 2 || m[i + 1] >> 6 != 3)
 			continue;
 
 		/* ALU and MOV
@@ -69,7 +68,7 @@ int main(int argc, char **argv)
 				if (w != b) {
 					/* toggle D-bit, swap reg and r/m */
 					m[i] ^= 2;
-					m[i + 1] = 0xc0 | (hs.modrm_rm << 3) | hs.modrm_reg;
+					m[i + 1] = 0xc0 | (m[i + 1] & 7) << 3 | (m[i + 1] >> 3 & 7);
 				}
 			} else {
 				/* read bit from insn */
@@ -0,0 +1,295 @@
+/*
+pride.h demo and check
+
+./pride-iter [-s seed] [-g generator] [-k count] n
+./pride-iter -b
+./pride-iter [-s seed] -p threads n
+
+prints the first count indices of a random (or given) permutation of
+[0, n), then walks all of it with pride_next(), pride_fill() and
+pride_at(), checks that the three agree and that every index was seen
+exactly once (a bitset, n bits), and times them.
+
+-b compares struct pride64 with x = (x + g) % n and with (s + g * i) % n
+for n from 2^10 to 2^40, 2^26 indices each, in indices per ns.
+
+A keyed pride_perm of n (key = seed) is checked the same way, in both
+kinds of domains, and pride_perm_index() must undo pride_perm_at(). -b
+times these too, for a few 32 and 64-bit n.
+
+-p walks the permutation with pride_for() on that many threads, checks
+that every index was visited exactly once and prints how many indices
+each worker got. Indices below n / 16 cost a hundred times more than the
+rest, and worker 1 sleeps after every block, so stealing has work to do.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pride.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define BENCH	(1 << 26)
+
+/* a store the loops can't be moved past the clock */
+static volatile uint64_t sink;
+
+static void bench(uint64_t seed)
+{
+	static uint64_t buf[4096];
+	struct pride64 p, q;
+	uint64_t sum = 0, i, j;
+	double t[6];
+	int k;
+
+	printf("     n   %%-step     next     fill   %%-at   at\n");
+	for (k = 10; k <= 40; k += k < 16 ? 6 : 4) {
+		uint64_t n = (1ULL << k) - 3, x, g;
+		pride64_random(&p, n, seed);
+		x = p.s, g = p.g;
+		t[0] = now();
+		for (i = 0; i < BENCH; i++) {
+			sum += x;
+			x = (x + g) % n;
+		}
+		sink = sum;
+		t[1] = now();
+		for (i = 0, q = p; i < BENCH; i++)
+			sum += pride64_next(&q);
+		sink = sum;
+		t[2] = now();
+		for (i = 0, q = p; i < BENCH; i += 4096) {
+			pride64_fill(&q, buf, 4096);
+			for (j = 0; j < 4096; j++)
+				sum += buf[j];
+		}
+		sink = sum;
+		t[3] = now();
+		for (i = 0; i < BENCH; i++)
+			sum += (p.s + (pride_u128)p.g * i) % n;
+		sink = sum;
+		t[4] = now();
+		for (i = 0; i < BENCH; i++)
+			sum += pride64_at(&p, i);
+		sink = sum;
+		t[5] = now();
+		printf("2^%-2d", k);
+		for (j = 0; j < 5; j++)
+			printf(" %8.3f", BENCH / ((t[j + 1] - t[j]) * 1e9));
+		puts("");
+		/* keep the loops, and check the last index of each */
+		if (x != pride64_at(&p, BENCH) || q.x != x)
+			printf("FAILED: n %lu\n", n);
+	}
+	static const uint64_t kn[] = { 1000000000, (1ULL << 31) + 1, 1000000000000000, (1ULL << 62) + 1 };
+	printf("\nkeyed, ns per index   pow2 at  index   prime at  index\n");
+	for (k = 0; k < 4; k++) {
+		struct pride_perm pp[2];
+		printf("%20lu", kn[k]);
+		for (int type = 0; type < 2; type++) {
+			pride_perm_init(&pp[type], kn[k], seed, type);
+			t[0] = now();
+			for (i = 0; i < BENCH / 4; i++)
+				sum += pride_perm_at(&pp[type], i);
+			sink = sum;
+			t[1] = now();
+			for (i = 0; i < BENCH / 4; i++)
+				sum += pride_perm_index(&pp[type], i);
+			sink = sum;
+			t[2] = now();
+			printf("  %8.2f %6.2f", (t[1] - t[0]) * 4e9 / BENCH, (t[2] - t[1]) * 4e9 / BENCH);
+		}
+		puts("");
+	}
+	printf("(%lx)\n", sum);
+}
+
+/* 0 or 1 and a message */
+static int keyed(uint64_t n, uint64_t key, int type)
+{
+	static const char *name[] = { "pow2", "prime" };
+	struct pride_perm pp;
+	uint64_t *seen = calloc(n / 64 + 1, 8), i, x, total = 0;
+	if (seen == NULL || pride_perm_init(&pp, n, key, type) < 0) {
+		perror("pride_perm_init");
+		return 1;
+	}
+	double t0 = now();
+	for (i = 0; i < n; i++) {
+		x = pride_perm_at(&pp, i);
+		seen[x >> 6] |= 1ULL << (x & 63);
+	}
+	double t1 = now();
+	for (i = 0; i < n; i++)
+		if (pride_perm_index(&pp, pride_perm_at(&pp, i)) != i) {
+			printf("FAILED: %s index(at(%lu))\n", name[type], i);
+			return 1;
+		}
+	double t2 = now();
+	for (i = 0; i <= n / 64; i++)
+		total += __builtin_popcountll(seen[i]);
+	free(seen);
+	if (total != n) {
+		printf("FAILED: %s %lu of %lu indices\n", name[type], total, n);
+		return 1;
+	}
+	printf("ok, keyed %s m %lu:", name[type], pp.m);
+	for (i = 0; i < 8 && i < n; i++)
+		printf(" %lu", pride_perm_at(&pp, i));
+	printf(", at %.2f ns, at+index %.2f ns\n", (t1 - t0) * 1e9 / n, (t2 - t1) * 1e9 / n);
+	return 0;
+}
+
+struct par {
+	uint64_t *seen;
+	uint32_t n;
+	long count[64];
+	long dup;	/* indices visited again */
+};
+
+static void visit(const uint32_t *idx, size_t count, int worker, void *arg)
+{
+	struct par *a = arg;
+	volatile uint32_t spin = 0;
+	for (size_t k = 0; k < count; k++) {
+		uint32_t x = idx[k];
+		if (__atomic_fetch_or(&a->seen[x >> 6], 1ULL << (x & 63), __ATOMIC_RELAXED) & 1ULL << (x & 63))
+			__atomic_fetch_add(&a->dup, 1, __ATOMIC_RELAXED);
+		for (int j = x < a->n / 16 ? 100 : 1; j; j--)
+			spin += x;
+	}
+	if (worker == 1)
+		usleep(100);
+	__atomic_fetch_add(&a->count[worker & 63], count, __ATOMIC_RELAXED);
+}
+
+static int parallel(struct pride *p, int nth)
+{
+	struct par a = { calloc(p->n / 64 + 1, 8), p->n };
+	uint64_t total = 0, visits = 0, i;
+	double t0 = now();
+
+	if (a.seen == NULL || pride_for(p, nth, visit, &a) < 0) {
+		perror("pride_for");
+		return 2;
+	}
+	double t1 = now();
+	for (i = 0; i <= p->n / 64; i++)
+		total += __builtin_popcountll(a.seen[i]);
+	for (i = 0; i < 64; i++)
+		visits += a.count[i];
+	for (i = 0; i < (uint64_t)nth && i < 64; i++)
+		printf("%ld ", a.count[i]);
+	/* every index, and each of them once */
+	int bad = total != p->n || visits != p->n || a.dup != 0;
+	printf("\n%s, %lu of %u indices, %lu visits, %ld again, %.3f s\n", bad ? "FAILED" : "ok",
+		total, p->n, visits, a.dup, t1 - t0);
+	free(a.seen);
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t seed = time(NULL), i;
+	uint32_t n, g = 0, buf[4096];
+	size_t count = 16;
+	int opt, given = 0, nth = 0;
+	struct pride p, q;
+
+	while ((opt = getopt(argc, argv, "s:g:k:bp:")) != -1)
+		switch (opt) {
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'g':
+			g = strtoul(optarg, NULL, 0);
+			given = 1;
+			break;
+		case 'k':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bench(seed);
+			return 0;
+		case 'p':
+			nth = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-s seed] [-g generator] [-k count] n | -b\n", argv[0]);
+			return 2;
+		}
+	if (optind >= argc || (n = strtoul(argv[optind], NULL, 0)) == 0) {
+		printf("Usage: %s [-s seed] [-g generator] [-k count] n | -b\n", argv[0]);
+		return 2;
+	}
+	if ((given ? pride_init(&p, n, seed, g) : pride_random(&p, n, seed)) < 0) {
+		printf("%u is not a generator of Z%u\n", g, n);
+		return 2;
+	}
+	if (nth)
+		return parallel(&p, nth);
+	printf("n %u s %u g %u:", p.n, p.s, p.g);
+	q = p;
+	for (i = 0; i < count && i < n; i++)
+		printf(" %u", pride_next(&q));
+	puts("");
+
+	uint64_t *seen = calloc(n / 64 + 1, 8), bad = 0, total = 0;
+	if (seen == NULL) {
+		perror("calloc");
+		return 2;
+	}
+	q = p;
+	for (i = 0; i < n; i += 4096) {
+		size_t k = n - i < 4096 ? n - i : 4096;
+		pride_fill(&q, buf, k);
+		for (size_t j = 0; j < k; j++)
+			seen[buf[j] >> 6] |= 1ULL << (buf[j] & 63);
+	}
+	for (i = 0; i <= n / 64; i++)
+		total += __builtin_popcountll(seen[i]);
+	if (total != n || q.x != p.s) {
+		printf("FAILED: %lu of %u indices\n", total, n);
+		return 1;
+	}
+	/* the three must agree everywhere */
+	struct pride r = p;
+	uint32_t sum = 0;
+	q = p;
+	for (i = 0; i < n; i += 4096) {
+		size_t k = n - i < 4096 ? n - i : 4096;
+		pride_fill(&q, buf, k);
+		for (size_t j = 0; j < k; j++, bad++)
+			if (buf[j] != pride_next(&r) || buf[j] != pride_at(&p, i + j)) {
+				printf("FAILED: position %lu\n", bad);
+				return 1;
+			}
+	}
+	double t1 = now();
+	for (i = 0, q = p; i < n; i += 4096) {
+		size_t k = n - i < 4096 ? n - i : 4096;
+		pride_fill(&q, buf, k);
+		for (size_t j = 0; j < k; j++)
+			sum += buf[j];
+	}
+	double t2 = now();
+	for (i = 0, r = p; i < n; i++)
+		sum += pride_next(&r);
+	double t3 = now();
+	for (i = 0; i < n; i++)
+		sum += pride_at(&p, i);
+	double t4 = now();
+	printf("ok, %u indices, fill %.2f ns, next %.2f ns, at %.2f ns (%x)\n", n,
+		(t2 - t1) * 1e9 / n, (t3 - t2) * 1e9 / n, (t4 - t3) * 1e9 / n, sum);
+	free(seen);
+	return keyed(n, seed, PRIDE_POW2) | keyed(n, seed, PRIDE_PRIME);
+}
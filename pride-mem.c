@@ -0,0 +1,195 @@
+/*
+Memory latency and bandwidth with PRIDE orders, see pride.c and pride.h
+
+One buffer of 64-bit words, doubled from 4K up to max, read in five orders:
+
+seq	0, 1, 2, ... the prefetcher's favourite
+stride	every stride bytes, then again from the next word, covers all
+pride	s + g * i mod n with g close to 0.38 n, so consecutive reads are
+	far apart and on different pages, and the L2 streamer, which
+	works inside a page, has nothing to follow. The loads don't
+	depend on each other, the core keeps many of them in flight
+pride+	the same, plus a useless dependency: the next index is mixed with
+	the value just read, so the core can't run ahead and each read
+	costs the full latency
+chase	the buffer is a random single cycle (Sattolo), x = a[x]
+
+The difference between pride and chase at a size is how much memory level
+parallelism buys. ns per access and GB/s of the words read (8 bytes per
+access, not the lines moved) are printed for each. At least 2^24 accesses
+per order and size (the whole buffer for seq/stride/pride), chase and
+pride+ stop at 2^24. Up to 64M each order runs twice and the first run
+only warms the caches, above that nothing fits anyway.
+
+./pride-mem [-m max] [-s stride] [-H]
+
+-m takes k, m and g suffixes, -H asks for transparent huge pages.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pride.h"
+
+#define MIN_ACCESS	(1UL << 24)
+
+enum { M_SEQ, M_STRIDE, M_PRIDE, M_PRIDE_DEP, M_CHASE, M_NUM };
+static const char *modes[] = { "seq", "stride", "pride", "pride+", "chase" };
+
+/* a store the loops can't be moved past the clock */
+static volatile uint64_t sink;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t parse_size(const char *s)
+{
+	char *e;
+	size_t v = strtoull(s, &e, 0);
+	switch (*e | 0x20) {
+	case 'g':
+		v <<= 10;
+		/* fall through */
+	case 'm':
+		v <<= 10;
+		/* fall through */
+	case 'k':
+		v <<= 10;
+	}
+	return v;
+}
+
+/* a[x] is the next x, one cycle through all n */
+static void sattolo(uint64_t *a, size_t n, uint64_t seed)
+{
+	size_t i, j;
+	for (i = 0; i < n; i++)
+		a[i] = i;
+	for (i = n - 1; i > 0; i--) {
+		j = pride_mix(&seed) % i;
+		uint64_t t = a[i];
+		a[i] = a[j];
+		a[j] = t;
+	}
+}
+
+/* accesses done, 0 if the mode can't run, sum of the words to sink */
+static size_t walk(int mode, const uint64_t *a, size_t n, size_t stride, uint64_t seed)
+{
+	static uint32_t buf[1024];
+	size_t want = n > MIN_ACCESS ? n : MIN_ACCESS, done = 0, i, j;
+	uint64_t sum = 0, x;
+	struct pride p;
+	uint32_t g;
+
+	switch (mode) {
+	case M_SEQ:
+		for (; done < want; done += n)
+			for (i = 0; i < n; i++)
+				sum += a[i];
+		break;
+	case M_STRIDE:
+		if (stride > n)
+			stride = n;
+		for (; done < want; done += n)
+			for (j = 0; j < stride; j++)
+				for (i = j; i < n; i += stride)
+					sum += a[i];
+		break;
+	case M_PRIDE:
+	case M_PRIDE_DEP:
+		for (g = n * 0.381966; pride_gcd(g, n) != 1; g++)
+			;
+		if (pride_init(&p, n, pride_mix(&seed), g) < 0)
+			return 0;
+		if (mode == M_PRIDE_DEP) {
+			/* a[x] < n and the sum is 0, x doesn't change, but the CPU doesn't know */
+			for (x = p.s; done < MIN_ACCESS; done++)
+				x = pride_step(x + (a[x] >> 63), g, n);
+			sum = x;
+			break;
+		}
+		for (; done < want; done += n)
+			for (i = 0; i < n; i += j) {
+				j = n - i < 1024 ? n - i : 1024;
+				pride_fill(&p, buf, j);
+				for (size_t k = 0; k < j; k++)
+					sum += a[buf[k]];
+			}
+		break;
+	case M_CHASE:
+		for (x = 0; done < MIN_ACCESS; done++)
+			x = a[x];
+		sum = x;
+		break;
+	}
+	sink = sum;
+	return done;
+}
+
+int main(int argc, char **argv)
+{
+	size_t max = 1UL << 30, stride = 4096, size;
+	uint64_t seed = time(NULL);
+	int opt, huge = 0, m;
+
+	while ((opt = getopt(argc, argv, "m:s:H")) != -1)
+		switch (opt) {
+		case 'm':
+			max = parse_size(optarg);
+			break;
+		case 's':
+			stride = parse_size(optarg);
+			break;
+		case 'H':
+			huge = 1;
+			break;
+		default:
+			printf("Usage: %s [-m max] [-s stride] [-H]\n", argv[0]);
+			return 2;
+		}
+	if (max < 4096 || max / 8 > UINT32_MAX || stride < 8) {
+		printf("Usage: %s [-m max] [-s stride] [-H]\n", argv[0]);
+		return 2;
+	}
+	uint64_t *a = mmap(NULL, max, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (a == MAP_FAILED) {
+		perror("mmap");
+		return 2;
+	}
+	if (huge && madvise(a, max, MADV_HUGEPAGE) < 0)
+		perror("madvise");
+
+	printf("%10s", "size");
+	for (m = 0; m < M_NUM; m++)
+		printf(" %8s ns   GB/s", modes[m]);
+	puts("");
+	for (size = 4096; size <= max; size *= 2) {
+		size_t n = size / 8;
+		sattolo(a, n, seed);
+		printf("%9zuK", size >> 10);
+		for (m = 0; m < M_NUM; m++) {
+			if (size <= 64 << 20)
+				walk(m, a, n, stride / 8, seed);
+			double t0 = now();
+			size_t done = walk(m, a, n, stride / 8, seed);
+			double t = now() - t0;
+			if (done == 0)
+				printf(" %11s %6s", "-", "-");
+			else
+				printf(" %11.2f %6.2f", t * 1e9 / done, done * 8 / t / 1e9);
+		}
+		puts("");
+		fflush(stdout);
+	}
+	munmap(a, max);
+	return 0;
+}
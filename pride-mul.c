@@ -15,10 +15,14 @@ int gcd(int a, int b)
 int main(int argc, char **argv)
 {
 	unsigned a, b, c, i, x, y, n;
-	unsigned o[64];
 
 	srandom(time(NULL));
-	n = argv[1] ? atoi(argv[1]) : 8;
+	/* o[] is on the stack, and n^3 numbers are printed anyway */
+	unsigned long arg = argv[1] ? strtoul(argv[1], NULL, 0) : 8;
+	if (arg < 1 || arg > 50000)
+		return 2;
+	n = arg;
+	unsigned o[n];
 	for (a = 1; a < n; a++)
 	for (b = 1; b < n; b++) {
 		/*
@@ -31,8 +35,8 @@ int main(int argc, char **argv)
 		bzero(o, sizeof(o));
 		for (y = 0, i = 0; i < n; i++) {
 			/* x = (a + b * i) % n; */
-			x = (y + a) % n;
-			y = (y + b) % n;
+			x = y + a >= n ? y + a - n : y + a;
+			y = y + b >= n ? y + b - n : y + b;
 			o[x]++;
 			printf("%d ", x);
 		}
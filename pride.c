@@ -190,10 +190,29 @@ idea. It's much more simple and generic than it appears. The resulting algo
 works with any N and with a wider range of values for I1 and I2. One can use
 modular addition and subtraction for any i1 and i2 which passed the test
 and XOR with Z_{2^n} since it's additive under XOR.
+
+The check below was five loops over s1, s2, i1, i2 and the walk, n^5 steps,
+fine up to 30 or so. By the same regrouping only g = (i1 + i2) mod n has to
+be walked, and only from one start, a different s just shifts all indices.
+So each g in [0, n) is walked once, n bits are set and counted, and the walk
+must cover all of them exactly when gcd(g, n) == 1, both ways. That's n^2
+steps, split over threads, and the counts come from how many (i1, i2) map
+to each g: n - 1 pairs for g = 0, n - 2 for the others, times n^2 starts.
+While at it, it prints the pride-mul.c counts for x = a + b * i:
+(n - 1) * phi(n) pairs with any a and phi(n)^2 with a coprime as well.
+
+./pride [-r] [-t threads] [from] to (up to 50000, the counts fit into 64 bits)
+
+-r runs the old five loops instead (keep n small).
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "pride.h"
 
 int gcd(int a, int b)
 {
@@ -206,35 +225,134 @@ int gcd(int a, int b)
 	return a;
 }
 
-int main(int argc, char **argv)
+/* the original check, n^5 */
+long reference(int n)
 {
-	for (int n = 3; n < 30; n++) {
-		printf("== N=%d ", n);
-		int s1, s2, i1, i2, cc = 0;
-		for (s1 = 0; s1 < n; s1++)
-		for (s2 = 0; s2 < n; s2++)
-		for (i1 = 1; i1 < n; i1++)
-		for (i2 = 1; i2 < n; i2++) {
-			if (gcd(i1 + i2, n) != 1)
-				continue;
-			char c[n], i;
-			bzero(c, sizeof(c));
-			int r1 = s1, r2 = s2;
-			for (i = 0; i < n; i++) {
-				int r = (r1 + r2) % n;
-				c[r]++;
-				r1 = (r1 + i1) % n;
-				r2 = (r2 + i2) % n;
+	int s1, s2, i1, i2;
+	long cc = 0;
+	for (s1 = 0; s1 < n; s1++)
+	for (s2 = 0; s2 < n; s2++)
+	for (i1 = 1; i1 < n; i1++)
+	for (i2 = 1; i2 < n; i2++) {
+		if (gcd(i1 + i2, n) != 1)
+			continue;
+		char c[n];
+		int i;
+		bzero(c, sizeof(c));
+		int r1 = s1, r2 = s2;
+		/* r1, r2 < n and i1, i2 < n, no need to divide */
+		for (i = 0; i < n; i++) {
+			int r = r1 + r2 >= n ? r1 + r2 - n : r1 + r2;
+			c[r]++;
+			r1 = r1 + i1 >= n ? r1 + i1 - n : r1 + i1;
+			r2 = r2 + i2 >= n ? r2 + i2 - n : r2 + i2;
+		}
+		for (i = 0; i < n; i++)
+			if (c[i] != 1)
+				break;
+		cc++;
+		if (i != n)
+			return -1;
+	}
+	return cc;
+}
+
+struct verify {
+	uint32_t n, next;	/* next g to take, shared */
+	uint32_t gen;		/* g that covered everything */
+	uint32_t bad;		/* g where coverage and gcd disagree */
+};
+
+void *worker(void *arg)
+{
+	struct verify *v = arg;
+	uint32_t n = v->n, gen = 0, bad = 0, g, e, x, i;
+	uint64_t *bits = malloc((n / 64 + 1) * sizeof(uint64_t));
+
+	if (bits == NULL) {
+		perror("malloc");
+		exit(2);
+	}
+	while ((g = __atomic_fetch_add(&v->next, 64, __ATOMIC_RELAXED)) < n)
+		for (e = g + 64 < n ? g + 64 : n; g < e; g++) {
+			long seen = 0;
+			memset(bits, 0, (n / 64 + 1) * sizeof(uint64_t));
+			for (x = 0, i = 0; i < n; i++) {
+				bits[x >> 6] |= 1ULL << (x & 63);
+				x = pride_step(x, g, n);
 			}
-			for (i = 0; i < n; i++)
-				if (c[i] != 1)
-					break;
-			cc++;
-			if (i != n) {
+			for (i = 0; i <= n / 64; i++)
+				seen += __builtin_popcountll(bits[i]);
+			gen += seen == n;
+			bad += (seen == n) != (pride_gcd(g, n) == 1);
+		}
+	free(bits);
+	__atomic_fetch_add(&v->gen, gen, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&v->bad, bad, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/* generators of Z_n found by walking, -1 if any g disagrees with gcd or a thread didn't start */
+long verify(uint32_t n, int nth)
+{
+	struct verify v = { n, 0, 0, 0 };
+	pthread_t th[nth];
+	int i, started, e = 0;
+
+	for (started = 0; started < nth; started++)
+		if ((e = pthread_create(&th[started], NULL, worker, &v)) != 0) {
+			printf("pthread_create: %s ", strerror(e));
+			break;
+		}
+	for (i = 0; i < started; i++)
+		pthread_join(th[i], NULL);
+	return v.bad || e ? -1 : (long)v.gen;
+}
+
+int main(int argc, char **argv)
+{
+	int opt, ref = 0, nth = sysconf(_SC_NPROCESSORS_ONLN);
+	long from = 3, to = 29, n;
+
+	while ((opt = getopt(argc, argv, "rt:")) != -1)
+		switch (opt) {
+		case 'r':
+			ref = 1;
+			break;
+		case 't':
+			nth = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-r] [-t threads] [from] to\n", argv[0]);
+			return 2;
+		}
+	if (optind < argc)
+		to = atol(argv[argc - 1]);
+	if (optind + 1 < argc)
+		from = atol(argv[optind]);
+	if (from < 3 || to < from || to > 50000 || nth < 1) {
+		printf("Usage: %s [-r] [-t threads] [from] to\n", argv[0]);
+		return 2;
+	}
+	for (n = from; n <= to; n++) {
+		long cc, phi;
+		printf("== N=%ld ", n);
+		fflush(stdout);
+		if (ref) {
+			if ((cc = reference(n)) < 0) {
 				printf("FAILED!\n");
 				return 2;
 			}
+			printf(" (%ld variants)\n", cc);
+			continue;
+		}
+		if ((phi = verify(n, nth)) < 0) {
+			printf("FAILED!\n");
+			return 2;
 		}
-		printf(" (%d variants)\n", cc);
+		/* g = 0 is never a generator for n > 1 */
+		cc = n * n * (n - 2) * phi;
+		printf(" (%ld variants) phi %ld, a + b * i: %ld, %ld\n", cc, phi, (n - 1) * phi, phi * phi);
 	}
+	return 0;
 }
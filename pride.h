@@ -0,0 +1,582 @@
+/*
+PRIDE index streams, see pride.c and pride-mul.c
+
+	x(i) = s + g * i mod n, gcd(g, n) == 1
+
+visits every index of [0, n) exactly once, in an order that depends on
+(s, g) and nothing else, so an array can be walked in a shuffled order
+without storing the permutation. Three ways to get the indices:
+
+pride_next()	one at a time. x < n and g < n, so the next one is x + g
+		or x + g - n, a compare instead of a divide
+pride_fill()	a block at a time, with AVX2 eight lanes hold x(i)..x(i+7)
+		and all of them step by 8g mod n with the same compare
+		(min_epu32 of the sum and the sum minus n, which works while
+		the sum fits into 32 bits, i.e. n <= 2^31, scalar above that)
+pride_at()	x(i) for any i, one multiply and one modulo
+
+n is up to 2^32 - 1, positions are 64-bit and wrap around after n.
+
+struct pride64 is the same for n up to 2^64 - 1. Stepping is the same
+compare, but g * i no longer fits into 64 bits and 128 by 64 modulo is a
+libgcc call (a divq, if we are lucky), so pride64_at() uses Barrett
+reduction: with mu = (2^128 - 1) / n computed once, the quotient of x < n * 2^64
+is the high half of x * mu, 2 too small at most, and x - q * n is fixed up
+with two conditional moves. pride64_fill() runs four 64-bit lanes on AVX2, that
+needs a signed compare, so n <= 2^62.
+
+pride_for() runs a function over all n indices on threads (link with
+-pthread). Since x(i) is O(1) for any i, positions split into ranges
+with nothing shared but the bounds: every worker starts with n / nth
+positions, takes PRIDE_CHUNK of them at a time from the front and fills
+a buffer of indices. A worker that runs dry steals the back half of
+someone else's range. lo and hi are packed into one word, so both taking
+and stealing are a single compare-and-swap.
+
+The walk itself is easy to spot: x(i + 1) - x(i) is always g. struct
+pride_perm is a keyed permutation of [0, n) for any n < 2^64, in the
+forms from pride-mul.c, on a slightly larger group where they are easy:
+
+PRIDE_POW2	m = 2^k >= n, rounds of x = a * x + b (a odd, so it's
+		invertible mod 2^k) and x ^= x >> (k + 1) / 2, which is its
+		own inverse and mixes the high bits down
+PRIDE_PRIME	m = the first prime >= n, one round of a * x + b mod m,
+		any a != 0 will do. Affine maps compose into an affine map,
+		so more rounds would buy nothing, and it's PRIDE with a
+		keyed g again (neighbours differ by a, unless they walked):
+		the cheap one, for when the order only has to be spread out
+
+A value that lands in [n, m) is mapped again until it's below n (cycle
+walking), this stays a permutation of [0, n) because the walk follows the
+cycle of the larger one. Prime gaps are tiny, so with PRIDE_PRIME it is
+almost never needed, with PRIDE_POW2 it's m / n < 2 maps on average
+(but a branch that goes either way).
+pride_perm_index() is the inverse, the same walk with the inverse maps,
+a^-1 is precomputed.
+*/
+#ifndef _PRIDE_H_
+#define _PRIDE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+#include <immintrin.h>
+#include <pthread.h>
+
+struct pride {
+	uint32_t n, s, g;	/* g is coprime with n */
+	uint32_t x;		/* index at position i */
+	uint64_t i;
+};
+
+static inline uint32_t pride_gcd(uint32_t a, uint32_t b)
+{
+	for (uint32_t t; b; t = b, b = a % b, a = t)
+		;
+	return a;
+}
+
+/* 0 or -1 if n is 0 or g is not a generator */
+static inline int pride_init(struct pride *p, uint32_t n, uint32_t s, uint32_t g)
+{
+	if (n == 0 || pride_gcd(g % n, n) != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	p->n = n;
+	p->s = s % n;
+	p->g = g % n;
+	p->x = p->s;
+	p->i = 0;
+	return 0;
+}
+
+static inline uint64_t pride_mix(uint64_t *seed)
+{
+	uint64_t z = (*seed += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* random s and g from the seed, 0 or -1 if n is 0 */
+static inline int pride_random(struct pride *p, uint32_t n, uint64_t seed)
+{
+	uint32_t s, g;
+	if (n == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	s = pride_mix(&seed) % n;
+	/* phi(n)/n is above 1/(2 ln ln n + 3), a few tries at most */
+	do
+		g = n > 1 ? 1 + pride_mix(&seed) % (n - 1) : 0;
+	while (pride_gcd(g, n) != 1);
+	return pride_init(p, n, s, g);
+}
+
+/* index at position i */
+static inline uint32_t pride_at(const struct pride *p, uint64_t i)
+{
+	return (p->s + (uint64_t)p->g * (i % p->n)) % p->n;
+}
+
+static inline void pride_seek(struct pride *p, uint64_t i)
+{
+	p->x = pride_at(p, i);
+	p->i = i;
+}
+
+/* x + g mod n without overflow or divide, x and g below n */
+static inline uint32_t pride_step(uint32_t x, uint32_t g, uint32_t n)
+{
+	return x >= n - g ? x - (n - g) : x + g;
+}
+
+static inline uint32_t pride_next(struct pride *p)
+{
+	uint32_t x = p->x;
+	p->x = pride_step(x, p->g, p->n);
+	p->i++;
+	return x;
+}
+
+static inline size_t pride_fill_scalar(struct pride *p, uint32_t *out, size_t count)
+{
+	uint32_t x = p->x, g = p->g, n = p->n;
+	for (size_t k = 0; k < count; k++) {
+		out[k] = x;
+		x = pride_step(x, g, n);
+	}
+	p->x = x;
+	p->i += count;
+	return count;
+}
+
+__attribute__((target("avx2")))
+static inline size_t pride_fill_avx2(struct pride *p, uint32_t *out, size_t count)
+{
+	uint32_t lane[8], x = p->x, n = p->n, k;
+	size_t j = 0;
+	if (count >= 8) {
+		for (k = 0; k < 8; k++) {
+			lane[k] = x;
+			x = pride_step(x, p->g, n);
+		}
+		/* x is now x(i + 8), 8g mod n is its distance from x(i) */
+		uint32_t g8 = x >= lane[0] ? x - lane[0] : x + (n - lane[0]);
+		__m256i v = _mm256_loadu_si256((__m256i *)lane);
+		__m256i G = _mm256_set1_epi32(g8), N = _mm256_set1_epi32(n);
+		for (; j + 8 <= count; j += 8) {
+			_mm256_storeu_si256((__m256i *)(out + j), v);
+			__m256i t = _mm256_add_epi32(v, G);
+			v = _mm256_min_epu32(t, _mm256_sub_epi32(t, N));
+		}
+		_mm256_storeu_si256((__m256i *)lane, v);
+		x = lane[0];
+	}
+	p->x = x;
+	p->i += j;
+	return j + pride_fill_scalar(p, out + j, count - j);
+}
+
+/* next count indices to out */
+static inline size_t pride_fill(struct pride *p, uint32_t *out, size_t count)
+{
+	static int avx2 = -1;
+	if (avx2 < 0) {
+		__builtin_cpu_init();
+		avx2 = __builtin_cpu_supports("avx2");
+	}
+	if (avx2 && p->n <= 1U << 31)
+		return pride_fill_avx2(p, out, count);
+	return pride_fill_scalar(p, out, count);
+}
+
+#define PRIDE_CHUNK	1024
+
+typedef void (*pride_fn)(const uint32_t *idx, size_t count, int worker, void *arg);
+
+struct pride_for;
+
+struct pride_worker {
+	uint64_t range;		/* hi << 32 | lo, positions not taken yet */
+	struct pride_for *f;
+	int id;
+} __attribute__((aligned(64)));
+
+struct pride_for {
+	const struct pride *p;
+	pride_fn fn;
+	void *arg;
+	int nth;
+	struct pride_worker *w;
+};
+
+/* moves the back half of someone's range to w, 0 if all are empty */
+static inline int pride_steal(struct pride_worker *w)
+{
+	struct pride_for *f = w->f;
+	for (int v = 1; v < f->nth; v++) {
+		struct pride_worker *victim = &f->w[(w->id + v) % f->nth];
+		uint64_t r = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+		uint32_t lo, hi, half;
+		do {
+			lo = r;
+			hi = r >> 32;
+			if (lo >= hi)
+				break;
+			half = (hi - lo + 1) / 2;
+		} while (!__atomic_compare_exchange_n(&victim->range, &r, (uint64_t)(hi - half) << 32 | lo,
+			0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+		if (lo < hi) {
+			__atomic_store_n(&w->range, (uint64_t)hi << 32 | (hi - half), __ATOMIC_RELEASE);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static inline void *pride_for_worker(void *arg)
+{
+	struct pride_worker *w = arg;
+	struct pride_for *f = w->f;
+	struct pride p = *f->p;
+	uint32_t buf[PRIDE_CHUNK];
+
+	do {
+		uint64_t r = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+		uint32_t lo = r, hi = r >> 32, k;
+		while (lo < hi) {
+			k = hi - lo < PRIDE_CHUNK ? hi - lo : PRIDE_CHUNK;
+			if (!__atomic_compare_exchange_n(&w->range, &r, (uint64_t)hi << 32 | (lo + k),
+			    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				lo = r;
+				hi = r >> 32;
+				continue;
+			}
+			pride_seek(&p, lo);
+			pride_fill(&p, buf, k);
+			f->fn(buf, k, w->id, f->arg);
+			lo += k;
+			r = (uint64_t)hi << 32 | lo;
+		}
+	} while (pride_steal(w));
+	return NULL;
+}
+
+/*
+fn(idx, count, worker, arg) for blocks of the permutation until all n
+indices have been passed exactly once, on nth threads, the caller is
+worker 0. 0 or -1 if nth < 1 or out of memory. If some threads can't be
+started the others do their share.
+*/
+static inline int pride_for(const struct pride *p, int nth, pride_fn fn, void *arg)
+{
+	struct pride_for f = { p, fn, arg, nth, NULL };
+	struct pride tmp = *p;
+	pthread_t th[nth > 0 ? nth : 1];
+	int i, started[nth > 0 ? nth : 1];
+
+	if (nth < 1 || posix_memalign((void **)&f.w, 64, nth * sizeof(struct pride_worker))) {
+		errno = nth < 1 ? EINVAL : ENOMEM;
+		return -1;
+	}
+	pride_fill(&tmp, NULL, 0);	/* CPU check before the threads */
+	for (i = 0; i < nth; i++) {
+		uint32_t lo = (uint64_t)p->n * i / nth, hi = (uint64_t)p->n * (i + 1) / nth;
+		f.w[i] = (struct pride_worker){ (uint64_t)hi << 32 | lo, &f, i };
+	}
+	for (i = 1; i < nth; i++)
+		started[i] = pthread_create(&th[i], NULL, pride_for_worker, &f.w[i]) == 0;
+	pride_for_worker(&f.w[0]);
+	for (i = 1; i < nth; i++)
+		if (started[i])
+			pthread_join(th[i], NULL);
+	free(f.w);
+	return 0;
+}
+
+typedef unsigned __int128 pride_u128;
+
+struct pride64 {
+	uint64_t n, s, g;
+	uint64_t x, i;
+	pride_u128 mu;		/* (2^128 - 1) / n */
+};
+
+/* x mod n for x < n * 2^64, so that the quotient fits into 64 bits, mu = (2^128 - 1) / n */
+static inline uint64_t pride_barrett(uint64_t n, pride_u128 mu, pride_u128 x)
+{
+	uint64_t x0 = x, x1 = x >> 64, m0 = mu, m1 = mu >> 64;
+	pride_u128 mid = ((pride_u128)x0 * m0 >> 64) + (pride_u128)x0 * m1 + (pride_u128)x1 * m0;
+	uint64_t q = x1 * m1 + (uint64_t)(mid >> 64);
+	/* q * n <= x and q is 2 too small at most */
+	if (n <= 1ULL << 62) {
+		/* r < 3n fits, ?: is a cmov, the branches would be random */
+		uint64_t r = x0 - q * n;
+		r = r >= n ? r - n : r;
+		return r >= n ? r - n : r;
+	}
+	pride_u128 r = x - (pride_u128)q * n;
+	if (r >= n)
+		r -= n;
+	if (r >= n)
+		r -= n;
+	return r;
+}
+
+static inline uint64_t pride64_mod(const struct pride64 *p, pride_u128 x)
+{
+	return pride_barrett(p->n, p->mu, x);
+}
+
+static inline uint64_t pride64_gcd(uint64_t a, uint64_t b)
+{
+	for (uint64_t t; b; t = b, b = a % b, a = t)
+		;
+	return a;
+}
+
+static inline int pride64_init(struct pride64 *p, uint64_t n, uint64_t s, uint64_t g)
+{
+	if (n == 0 || pride64_gcd(g % n, n) != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	p->n = n;
+	p->s = s % n;
+	p->g = g % n;
+	p->x = p->s;
+	p->i = 0;
+	p->mu = ~(pride_u128)0 / n;
+	return 0;
+}
+
+static inline int pride64_random(struct pride64 *p, uint64_t n, uint64_t seed)
+{
+	uint64_t s, g;
+	if (n == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	s = pride_mix(&seed) % n;
+	do
+		g = n > 1 ? 1 + pride_mix(&seed) % (n - 1) : 0;
+	while (pride64_gcd(g, n) != 1);
+	return pride64_init(p, n, s, g);
+}
+
+static inline uint64_t pride64_at(const struct pride64 *p, uint64_t i)
+{
+	if (i >= p->n)
+		i = pride64_mod(p, i);
+	return pride64_mod(p, p->s + (pride_u128)p->g * i);
+}
+
+static inline void pride64_seek(struct pride64 *p, uint64_t i)
+{
+	p->x = pride64_at(p, i);
+	p->i = i;
+}
+
+static inline uint64_t pride64_step(uint64_t x, uint64_t g, uint64_t n)
+{
+	return x >= n - g ? x - (n - g) : x + g;
+}
+
+static inline uint64_t pride64_next(struct pride64 *p)
+{
+	uint64_t x = p->x;
+	p->x = pride64_step(x, p->g, p->n);
+	p->i++;
+	return x;
+}
+
+static inline size_t pride64_fill_scalar(struct pride64 *p, uint64_t *out, size_t count)
+{
+	uint64_t x = p->x, g = p->g, n = p->n;
+	for (size_t k = 0; k < count; k++) {
+		out[k] = x;
+		x = pride64_step(x, g, n);
+	}
+	p->x = x;
+	p->i += count;
+	return count;
+}
+
+__attribute__((target("avx2")))
+static inline size_t pride64_fill_avx2(struct pride64 *p, uint64_t *out, size_t count)
+{
+	uint64_t lane[4], x = p->x, n = p->n, k;
+	size_t j = 0;
+	if (count >= 4) {
+		for (k = 0; k < 4; k++) {
+			lane[k] = x;
+			x = pride64_step(x, p->g, n);
+		}
+		uint64_t g4 = x >= lane[0] ? x - lane[0] : x + (n - lane[0]);
+		__m256i v = _mm256_loadu_si256((__m256i *)lane);
+		__m256i G = _mm256_set1_epi64x(g4), N = _mm256_set1_epi64x(n);
+		for (; j + 4 <= count; j += 4) {
+			_mm256_storeu_si256((__m256i *)(out + j), v);
+			__m256i t = _mm256_add_epi64(v, G);
+			v = _mm256_blendv_epi8(_mm256_sub_epi64(t, N), t, _mm256_cmpgt_epi64(N, t));
+		}
+		_mm256_storeu_si256((__m256i *)lane, v);
+		x = lane[0];
+	}
+	p->x = x;
+	p->i += j;
+	return j + pride64_fill_scalar(p, out + j, count - j);
+}
+
+static inline size_t pride64_fill(struct pride64 *p, uint64_t *out, size_t count)
+{
+	static int avx2 = -1;
+	if (avx2 < 0) {
+		__builtin_cpu_init();
+		avx2 = __builtin_cpu_supports("avx2");
+	}
+	if (avx2 && p->n <= 1ULL << 62)
+		return pride64_fill_avx2(p, out, count);
+	return pride64_fill_scalar(p, out, count);
+}
+
+enum { PRIDE_POW2, PRIDE_PRIME };
+
+#define PRIDE_ROUNDS	3
+
+struct pride_perm {
+	uint64_t n, m;		/* [0, n) is walked inside [0, m) */
+	int type, rounds, shift;
+	uint64_t mask;		/* m - 1 for PRIDE_POW2 */
+	uint64_t a[PRIDE_ROUNDS], b[PRIDE_ROUNDS], ai[PRIDE_ROUNDS];
+	pride_u128 mu;		/* Barrett for PRIDE_PRIME */
+};
+
+static inline uint64_t pride_mulmod(uint64_t a, uint64_t b, uint64_t m)
+{
+	return (pride_u128)a * b % m;
+}
+
+/* Miller-Rabin, these bases are enough below 2^64 */
+static inline int pride_is_prime(uint64_t n)
+{
+	static const uint64_t base[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+	uint64_t d = n - 1, x;
+	int r = 0, i, j;
+	if (n < 2)
+		return 0;
+	for (i = 0; i < 12; i++)
+		if (n % base[i] == 0)
+			return n == base[i];
+	for (; (d & 1) == 0; d >>= 1)
+		r++;
+	for (i = 0; i < 12; i++) {
+		uint64_t e = d, b = base[i];
+		for (x = 1; e; e >>= 1, b = pride_mulmod(b, b, n))
+			if (e & 1)
+				x = pride_mulmod(x, b, n);
+		if (x == 1 || x == n - 1)
+			continue;
+		for (j = 1; j < r && x != n - 1; j++)
+			x = pride_mulmod(x, x, n);
+		if (x != n - 1)
+			return 0;
+	}
+	return 1;
+}
+
+/* a^-1 mod m, gcd(a, m) == 1 */
+static inline uint64_t pride_inverse(uint64_t a, uint64_t m)
+{
+	__int128 t = 0, nt = 1, r = m, nr = a, q, tmp;
+	while (nr) {
+		q = r / nr;
+		tmp = t - q * nt, t = nt, nt = tmp;
+		tmp = r - q * nr, r = nr, nr = tmp;
+	}
+	return t < 0 ? t + m : t;
+}
+
+/* type is PRIDE_POW2 or PRIDE_PRIME, 0 or -1 if n is 0 or too large for a prime */
+static inline int pride_perm_init(struct pride_perm *p, uint64_t n, uint64_t key, int type)
+{
+	int i, k;
+	if (n == 0 || (type == PRIDE_PRIME && n > 18446744073709551557ULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+	p->n = n;
+	p->type = type;
+	if (type == PRIDE_PRIME) {
+		for (p->m = n; !pride_is_prime(p->m); p->m++)
+			;
+		p->mu = ~(pride_u128)0 / p->m;
+		p->rounds = 1;
+		p->a[0] = 1 + pride_mix(&key) % (p->m - 1);
+		p->b[0] = pride_mix(&key) % p->m;
+		p->ai[0] = pride_inverse(p->a[0], p->m);
+		return 0;
+	}
+	for (k = 0; k < 64 && (1ULL << k) < n; k++)
+		;
+	p->mask = k == 64 ? ~0ULL : (1ULL << k) - 1;
+	p->m = p->mask + 1;	/* 0 for 2^64, only used as a bound */
+	p->shift = (k + 1) / 2;
+	p->rounds = PRIDE_ROUNDS;
+	for (i = 0; i < p->rounds; i++) {
+		p->a[i] = pride_mix(&key) | 1;
+		p->b[i] = pride_mix(&key);
+		/* Newton, each step doubles the correct low bits */
+		uint64_t x = p->a[i];
+		for (int j = 0; j < 5; j++)
+			x *= 2 - p->a[i] * x;
+		p->ai[i] = x;
+	}
+	return 0;
+}
+
+static inline uint64_t pride_perm_map(const struct pride_perm *p, uint64_t x)
+{
+	if (p->type == PRIDE_PRIME)
+		return pride_barrett(p->m, p->mu, (pride_u128)p->a[0] * x + p->b[0]);
+	for (int i = 0; i < p->rounds; i++) {
+		x = (p->a[i] * x + p->b[i]) & p->mask;
+		x ^= x >> p->shift;
+	}
+	return x;
+}
+
+static inline uint64_t pride_perm_unmap(const struct pride_perm *p, uint64_t x)
+{
+	if (p->type == PRIDE_PRIME)
+		return pride_barrett(p->m, p->mu, (pride_u128)p->ai[0] * (x >= p->b[0] ? x - p->b[0] : x + (p->m - p->b[0])));
+	for (int i = p->rounds - 1; i >= 0; i--) {
+		x ^= x >> p->shift;
+		x = (p->ai[i] * (x - p->b[i])) & p->mask;
+	}
+	return x;
+}
+
+/* index at position i < n */
+static inline uint64_t pride_perm_at(const struct pride_perm *p, uint64_t i)
+{
+	do
+		i = pride_perm_map(p, i);
+	while (i >= p->n);
+	return i;
+}
+
+/* position of index x < n */
+static inline uint64_t pride_perm_index(const struct pride_perm *p, uint64_t x)
+{
+	do
+		x = pride_perm_unmap(p, x);
+	while (x >= p->n);
+	return x;
+}
+
+#endif /* _PRIDE_H_ */
@@ -119,10 +119,19 @@ https://dl.acm.org/doi/10.1145/366274.366304
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
 #include <strings.h>
 #include <stdint.h>
 #include <time.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include "strset.h"
 
 const char *needed[] = {
 	"fork",
@@ -172,180 +181,1510 @@ const char *ops[] = {
 #define ROR(x,y) ((unsigned)(x) >> (y) | (unsigned)(x) << (32 - (y)))
 #define ROL(x,y) ((unsigned)(x) << (y) | (unsigned)(x) >> (32 - (y)))
 
-int main(int argc, char **argv)
+/* reference interpreter, one switch per insn per char, h is the initial state */
+static uint32_t hash_interp(unsigned *prog, unsigned *args, int size, const char *s, int len, uint32_t h)
 {
-	/* bloom filter parameters */
-	int shift = 7;
-	int nh = 11;
-	int bloom_size = 256;
+	for (int j = 0; j < len; j++) {
+		unsigned c = s[j];
+		for (int k = 0; k < size; k++)
+			switch (prog[k]) {
+				case 0:		h += c;			break;
+				case 1: 	h -= c;			break;
+				case 2: 	h *= c;			break;
+				case 3: 	h ^= c;			break;
+				case 4: 	h |= c;			break;
+				case 5: 	h &= c;			break;
 
-	/* number of hash insns */
-	int size = 3;
+				case 0x10:	h += h << args[k];	break;
+				case 0x11:	h -= h << args[k];	break;
+				case 0x12:	h *= h << args[k];	break;
+				case 0x13:	h ^= h << args[k];	break;
+				case 0x14:	h += h >> args[k];	break;
+				case 0x15:	h -= h >> args[k];	break;
+				case 0x16:	h *= h >> args[k];	break;
+				case 0x17:	h ^= h >> args[k];	break;
+				case 0x18:	h = ROL(h, args[k]);	break;
+				case 0x19:	h = ROR(h, args[k]);	break;
+				case 0x1a:	h += args[k];		break;
+				case 0x1b:	h -= args[k];		break;
+				case 0x1c:	h *= args[k];		break;
+				case 0x1d:	h ^= args[k];		break;
+				case 0x1e:	h |= args[k];		break;
+				case 0x1f:	h &= args[k];		break;
+			}
+	}
+	return h;
+}
 
-	int i, j, k, needcount = 0;
-	unsigned int prog[32];
-	unsigned int args[32];
-	uint32_t b[1024];
+/*
+The switch costs a few mispredicted branches per byte, so the candidate is
+compiled into straight-line x86-64 (we're writing viruses after all):
 
-	srandom(time(NULL));
+	uint32_t hash(const char *s, int len, uint32_t h)
 
-	/* read strings */
-	int n = 0;
-	char s[1024];
-	char **list = NULL;
-	FILE *f = fopen("list.txt", "r");
-	if (f == NULL) {
-		printf("Failed to open list.txt\n");
-		return 2;
+h lives in eax, char in ecx, edx is scratch. The char is sign-extended,
+just like "unsigned c = s[j]" with signed char. h is 0 for the whole
+string, or the state after a prefix, see prefix_order().
+*/
+typedef uint32_t (*hash_fn)(const char *s, int len, uint32_t h);
+
+#ifdef	__x86_64__
+#define	JIT_SIZE	4096
+
+static uint8_t *emit(uint8_t *p, int n, ...)
+{
+	va_list ap;
+	va_start(ap, n);
+	while (n--)
+		*p++ = va_arg(ap, int);
+	va_end(ap);
+	return p;
+}
+
+static uint8_t *emit32(uint8_t *p, uint32_t v)
+{
+	memcpy(p, &v, 4);
+	return p + 4;
+}
+
+hash_fn jit(uint8_t *code, unsigned *prog, unsigned *args, int size)
+{
+	uint8_t *p = code, *loop, *jle;
+	p = emit(p, 4, 0x89, 0xd0, 0x85, 0xf6);		/* mov eax, edx; test esi, esi */
+	p = emit(p, 2, 0x0f, 0x8e);			/* jle done */
+	jle = p;
+	p += 4;
+	loop = p;
+	p = emit(p, 3, 0x0f, 0xbe, 0x0f);		/* movsx ecx, byte [rdi] */
+	for (int k = 0; k < size; k++) {
+		unsigned a = args[k];
+		switch (prog[k]) {
+			case 0:	p = emit(p, 2, 0x01, 0xc8);		break;	/* add eax, ecx */
+			case 1:	p = emit(p, 2, 0x29, 0xc8);		break;	/* sub eax, ecx */
+			case 2:	p = emit(p, 3, 0x0f, 0xaf, 0xc1);	break;	/* imul eax, ecx */
+			case 3:	p = emit(p, 2, 0x31, 0xc8);		break;	/* xor eax, ecx */
+			case 4:	p = emit(p, 2, 0x09, 0xc8);		break;	/* or eax, ecx */
+			case 5:	p = emit(p, 2, 0x21, 0xc8);		break;	/* and eax, ecx */
+
+			case 0x10 ... 0x17:
+				/* mov edx, eax; shl/shr edx, a; op eax, edx */
+				p = emit(p, 5, 0x89, 0xc2, 0xc1, prog[k] < 0x14 ? 0xe2 : 0xea, a);
+				switch (prog[k] & 3) {
+					case 0:	p = emit(p, 2, 0x01, 0xd0);		break;
+					case 1:	p = emit(p, 2, 0x29, 0xd0);		break;
+					case 2:	p = emit(p, 3, 0x0f, 0xaf, 0xc2);	break;
+					case 3:	p = emit(p, 2, 0x31, 0xd0);		break;
+				}
+				break;
+			case 0x18:	p = emit(p, 3, 0xc1, 0xc0, a);	break;	/* rol eax, a */
+			case 0x19:	p = emit(p, 3, 0xc1, 0xc8, a);	break;	/* ror eax, a */
+			case 0x1a:	p = emit32(emit(p, 1, 0x05), a);	break;	/* add eax, a */
+			case 0x1b:	p = emit32(emit(p, 1, 0x2d), a);	break;	/* sub eax, a */
+			case 0x1c:	p = emit32(emit(p, 2, 0x69, 0xc0), a);	break;	/* imul eax, eax, a */
+			case 0x1d:	p = emit32(emit(p, 1, 0x35), a);	break;	/* xor eax, a */
+			case 0x1e:	p = emit32(emit(p, 1, 0x0d), a);	break;	/* or eax, a */
+			case 0x1f:	p = emit32(emit(p, 1, 0x25), a);	break;	/* and eax, a */
+		}
+	}
+	p = emit(p, 5, 0x48, 0xff, 0xc7, 0xff, 0xce);	/* inc rdi; dec esi */
+	p = emit(p, 2, 0x0f, 0x85);			/* jnz loop */
+	p = emit32(p, loop - (p + 4));
+	emit32(jle, p - (jle + 4));
+	p = emit(p, 1, 0xc3);				/* ret */
+	assert(p - code < JIT_SIZE);
+	__builtin___clear_cache((char*)code, (char*)p);
+	return (hash_fn)code;
+}
+
+uint8_t *jit_alloc(void)
+{
+	void *p = mmap(NULL, JIT_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+#else
+hash_fn jit(uint8_t *code, unsigned *prog, unsigned *args, int size)
+{
+	return NULL;
+}
+
+uint8_t *jit_alloc(void)
+{
+	return NULL;
+}
+#endif
+
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* xorshift64*, one stream per thread instead of the global random() */
+static inline uint32_t rnd(uint64_t *s)
+{
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return (*s * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+/*
+SIMD: the same program on many strings at once. Strings are bucketed by
+length and transposed, char j of 16 strings of the same length is stored
+in 16 consecutive bytes. Then one vector load gets a column, it's sign
+extended to 32 bits, and every insn is one or two vector ops over 16 (two
+AVX2 registers or one AVX-512) hashes. Partial groups are padded with the
+first string of the group. The switch stays, but it's paid once per 16
+strings, not once per string.
+*/
+#define	LANES	16
+
+struct group {
+	int len, off;
+	int idx[LANES];		/* string index, -1 for padding */
+};
+
+struct tlayout {
+	int ng;
+	struct group *g;
+	int8_t *chars;
+};
+
+/* strings marked in skip (if any) are left out */
+struct tlayout *transpose(char **list, int *len, int n, uint32_t *skip)
+{
+	int i, j, l, max = 0, total = 0;
+	for (i = 0; i < n; i++)
+		if (len[i] > max)
+			max = len[i];
+	struct tlayout *tl = calloc(1, sizeof(struct tlayout));
+	tl->g = malloc((n / LANES + max + 1) * sizeof(struct group));
+	tl->chars = malloc((size_t)(n + LANES * (max + 1)) * (max + 1));
+	assert(tl->g != NULL && tl->chars != NULL);
+	for (l = 0; l <= max; l++) {
+		struct group *g = NULL;
+		int lane = LANES;
+		for (i = 0; i < n; i++) {
+			if (len[i] != l || (skip && (skip[i / 32] >> (i % 32)) & 1))
+				continue;
+			if (lane == LANES) {
+				g = &tl->g[tl->ng++];
+				g->len = l;
+				g->off = total;
+				total += l * LANES;
+				lane = 0;
+			}
+			g->idx[lane] = i;
+			for (j = 0; j < l; j++)
+				tl->chars[g->off + j * LANES + lane] = list[i][j];
+			lane++;
+		}
+		/* pad */
+		for (; g && lane < LANES; lane++) {
+			g->idx[lane] = -1;
+			for (j = 0; j < l; j++)
+				tl->chars[g->off + j * LANES + lane] = tl->chars[g->off + j * LANES];
+		}
+	}
+	return tl;
+}
+
+__attribute__((target("avx2")))
+static void hash_avx2(unsigned *prog, unsigned *args, int size, const int8_t *col, int len, uint32_t *out)
+{
+	__m256i h0 = _mm256_setzero_si256(), h1 = h0, t0, t1;
+	for (int j = 0; j < len; j++, col += LANES) {
+		__m128i c8 = _mm_loadu_si128((const __m128i *)col);
+		__m256i c0 = _mm256_cvtepi8_epi32(c8), c1 = _mm256_cvtepi8_epi32(_mm_srli_si128(c8, 8));
+		for (int k = 0; k < size; k++) {
+			__m128i a = _mm_cvtsi32_si128(args[k]), b = _mm_cvtsi32_si128(32 - args[k]);
+			__m256i v = _mm256_set1_epi32(args[k]);
+#define	OP2(f, x0, x1)	do { h0 = f(h0, x0); h1 = f(h1, x1); } while (0)
+#define	SH2(f, n)	do { t0 = f(h0, n); t1 = f(h1, n); } while (0)
+			switch (prog[k]) {
+				case 0:	OP2(_mm256_add_epi32, c0, c1);		break;
+				case 1:	OP2(_mm256_sub_epi32, c0, c1);		break;
+				case 2:	OP2(_mm256_mullo_epi32, c0, c1);	break;
+				case 3:	OP2(_mm256_xor_si256, c0, c1);		break;
+				case 4:	OP2(_mm256_or_si256, c0, c1);		break;
+				case 5:	OP2(_mm256_and_si256, c0, c1);		break;
+
+				case 0x10:	SH2(_mm256_sll_epi32, a);	OP2(_mm256_add_epi32, t0, t1);		break;
+				case 0x11:	SH2(_mm256_sll_epi32, a);	OP2(_mm256_sub_epi32, t0, t1);		break;
+				case 0x12:	SH2(_mm256_sll_epi32, a);	OP2(_mm256_mullo_epi32, t0, t1);	break;
+				case 0x13:	SH2(_mm256_sll_epi32, a);	OP2(_mm256_xor_si256, t0, t1);		break;
+				case 0x14:	SH2(_mm256_srl_epi32, a);	OP2(_mm256_add_epi32, t0, t1);		break;
+				case 0x15:	SH2(_mm256_srl_epi32, a);	OP2(_mm256_sub_epi32, t0, t1);		break;
+				case 0x16:	SH2(_mm256_srl_epi32, a);	OP2(_mm256_mullo_epi32, t0, t1);	break;
+				case 0x17:	SH2(_mm256_srl_epi32, a);	OP2(_mm256_xor_si256, t0, t1);		break;
+				/* shift by 32 gives 0 in SSE, so ROL by 0 is still h */
+				case 0x18:	SH2(_mm256_srl_epi32, b);	h0 = _mm256_or_si256(_mm256_sll_epi32(h0, a), t0);
+						h1 = _mm256_or_si256(_mm256_sll_epi32(h1, a), t1);	break;
+				case 0x19:	SH2(_mm256_sll_epi32, b);	h0 = _mm256_or_si256(_mm256_srl_epi32(h0, a), t0);
+						h1 = _mm256_or_si256(_mm256_srl_epi32(h1, a), t1);	break;
+				case 0x1a:	OP2(_mm256_add_epi32, v, v);	break;
+				case 0x1b:	OP2(_mm256_sub_epi32, v, v);	break;
+				case 0x1c:	OP2(_mm256_mullo_epi32, v, v);	break;
+				case 0x1d:	OP2(_mm256_xor_si256, v, v);	break;
+				case 0x1e:	OP2(_mm256_or_si256, v, v);	break;
+				case 0x1f:	OP2(_mm256_and_si256, v, v);	break;
+			}
+		}
+	}
+	_mm256_storeu_si256((__m256i *)out, h0);
+	_mm256_storeu_si256((__m256i *)(out + 8), h1);
+}
+
+__attribute__((target("avx512f")))
+static void hash_avx512(unsigned *prog, unsigned *args, int size, const int8_t *col, int len, uint32_t *out)
+{
+	__m512i h = _mm512_setzero_si512(), t;
+	for (int j = 0; j < len; j++, col += LANES) {
+		__m512i c = _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)col));
+		for (int k = 0; k < size; k++) {
+			__m128i a = _mm_cvtsi32_si128(args[k]);
+			__m512i v = _mm512_set1_epi32(args[k]);
+			switch (prog[k]) {
+				case 0:	h = _mm512_add_epi32(h, c);	break;
+				case 1:	h = _mm512_sub_epi32(h, c);	break;
+				case 2:	h = _mm512_mullo_epi32(h, c);	break;
+				case 3:	h = _mm512_xor_si512(h, c);	break;
+				case 4:	h = _mm512_or_si512(h, c);	break;
+				case 5:	h = _mm512_and_si512(h, c);	break;
+
+				case 0x10:	t = _mm512_sll_epi32(h, a);	h = _mm512_add_epi32(h, t);	break;
+				case 0x11:	t = _mm512_sll_epi32(h, a);	h = _mm512_sub_epi32(h, t);	break;
+				case 0x12:	t = _mm512_sll_epi32(h, a);	h = _mm512_mullo_epi32(h, t);	break;
+				case 0x13:	t = _mm512_sll_epi32(h, a);	h = _mm512_xor_si512(h, t);	break;
+				case 0x14:	t = _mm512_srl_epi32(h, a);	h = _mm512_add_epi32(h, t);	break;
+				case 0x15:	t = _mm512_srl_epi32(h, a);	h = _mm512_sub_epi32(h, t);	break;
+				case 0x16:	t = _mm512_srl_epi32(h, a);	h = _mm512_mullo_epi32(h, t);	break;
+				case 0x17:	t = _mm512_srl_epi32(h, a);	h = _mm512_xor_si512(h, t);	break;
+				case 0x18:	h = _mm512_rolv_epi32(h, v);	break;
+				case 0x19:	h = _mm512_rorv_epi32(h, v);	break;
+				case 0x1a:	h = _mm512_add_epi32(h, v);	break;
+				case 0x1b:	h = _mm512_sub_epi32(h, v);	break;
+				case 0x1c:	h = _mm512_mullo_epi32(h, v);	break;
+				case 0x1d:	h = _mm512_xor_si512(h, v);	break;
+				case 0x1e:	h = _mm512_or_si512(h, v);	break;
+				case 0x1f:	h = _mm512_and_si512(h, v);	break;
+			}
+		}
+	}
+	_mm512_storeu_si512(out, h);
+}
+
+enum { E_INTERP, E_JIT, E_AVX2, E_AVX512 };
+const char *engines[] = { "interp", "jit", "avx2", "avx512", NULL };
+
+int best_engine(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return E_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return E_AVX2;
+#ifdef	__x86_64__
+	return E_JIT;
+#else
+	return E_INTERP;
+#endif
+}
+
+/* H[i] for all strings */
+void hash_all(int engine, struct tlayout *tl, uint8_t *code, char **list, int *len, int n,
+	unsigned *prog, unsigned *args, int size, uint32_t *H)
+{
+	int i, j;
+	if (engine == E_AVX2 || engine == E_AVX512) {
+		uint32_t out[LANES];
+		for (i = 0; i < tl->ng; i++) {
+			struct group *g = &tl->g[i];
+			if (engine == E_AVX512)
+				hash_avx512(prog, args, size, tl->chars + g->off, g->len, out);
+			else
+				hash_avx2(prog, args, size, tl->chars + g->off, g->len, out);
+			for (j = 0; j < LANES && g->idx[j] >= 0; j++)
+				H[g->idx[j]] = out[j];
+		}
+		return;
+	}
+	hash_fn fn = engine == E_JIT && code ? jit(code, prog, args, size) : NULL;
+	for (i = 0; i < n; i++)
+		H[i] = fn ? fn(list[i], len[i], 0) : hash_interp(prog, args, size, list[i], len[i], 0);
+}
+
+/* ns per string for every engine, checked against the interpreter */
+void bench(struct tlayout *tl, char **list, int *len, int n, int size)
+{
+	int e, r, i, reps = 2000;
+	unsigned prog[reps][32], args[reps][32];
+	uint32_t *H = malloc(n * sizeof(uint32_t)), *R = malloc(n * sizeof(uint32_t));
+	uint8_t *code = jit_alloc();
+	uint64_t rng = time(NULL) | 1;
+	assert(H != NULL && R != NULL);
+	for (r = 0; r < reps; r++) {
+		int cp1 = rnd(&rng) % size;
+		for (i = 0; i < size; i++) {
+			prog[r][i] = i == cp1 ? rnd(&rng) % 6 : 0x10 + rnd(&rng) % 16;
+			args[r][i] = (1 + rnd(&rng)) & 0x1f;
+		}
 	}
-	while (fgets(s, sizeof(s), f)) {
-		char *p = s + strlen(s) - 1;
-		while (*p == '\n' || *p == '\r') {
-			*p = 0;
-			--p;
+	__builtin_cpu_init();
+	double base = 0;
+	for (e = E_INTERP; e <= E_AVX512; e++) {
+		if ((e == E_JIT && code == NULL) ||
+		    (e == E_AVX2 && !__builtin_cpu_supports("avx2")) ||
+		    (e == E_AVX512 && !__builtin_cpu_supports("avx512f")))
+			continue;
+		double t = 0;
+		for (r = 0; r < reps; r++) {
+			double t0 = now();
+			hash_all(e, tl, code, list, len, n, prog[r], args[r], size, H);
+			t += now() - t0;
+			hash_all(E_INTERP, tl, code, list, len, n, prog[r], args[r], size, R);
+			assert(memcmp(H, R, n * sizeof(uint32_t)) == 0);
 		}
-		list = realloc(list, (n + 1) * sizeof(char*));
-		assert(list != NULL);
-		list[n] = strdup(s);
-		n++;
+		t = t / reps / n * 1e9;
+		if (e == E_INTERP)
+			base = t;
+		printf("%-8s %6.2f ns/string, %.1fx\n", engines[e], t, base / t);
 	}
-	int *len = malloc(n * sizeof(int));
-	assert(len != NULL);
+}
+
+/*
+Prefix sharing. The program runs once per char, so the state after the
+first j chars of a string depends on these chars only. In sorted order
+libc names share long prefixes (pthread_, __, str...), and a string can
+start from the state the previous ones left at the common prefix. On
+list.txt it's 15.9k hashed chars instead of 34.2k.
+
+For every string we keep the depths which the following strings will
+start from, the states at these depths are saved on the way, so each
+string is one call per saved depth plus the tail.
+*/
+struct sorted {
+	char *s;
+	int i;
+};
+
+static int by_name(const void *a, const void *b)
+{
+	return strcmp(((struct sorted*)a)->s, ((struct sorted*)b)->s);
+}
+
+struct porder {
+	int n, max;
+	int *idx;		/* string index, in sorted order */
+	int *lcp;		/* common prefix with the previous string */
+	int *save, *nsave;	/* save[nsave[i]..nsave[i + 1]) depths to keep */
+};
+
+/* strings marked in skip (if any) are left out */
+struct porder *prefix_order(char **list, int *len, int n, uint32_t *skip)
+{
+	int i, k, m, ns = 0, total = 0;
+	struct sorted *t = malloc(n * sizeof(struct sorted));
+	struct porder *po = calloc(1, sizeof(struct porder));
+	assert(t != NULL && po != NULL);
 	for (i = 0; i < n; i++)
-		len[i] = strlen(list[i]);
-	assert(len != NULL);
-	unsigned *H = malloc(n * sizeof(int));
-	assert(H != NULL);
+		if (!(skip && (skip[i / 32] >> (i % 32)) & 1))
+			t[po->n++] = (struct sorted){ list[i], i };
+	qsort(t, po->n, sizeof(struct sorted), by_name);
+	po->idx = malloc(po->n * sizeof(int));
+	po->lcp = malloc((po->n + 1) * sizeof(int));
+	po->nsave = malloc((po->n + 1) * sizeof(int));
+	assert(po->idx != NULL && po->lcp != NULL && po->nsave != NULL);
+	for (i = 0; i < po->n; i++) {
+		po->idx[i] = t[i].i;
+		for (k = 0; i && t[i].s[k] && t[i].s[k] == t[i - 1].s[k]; k++)
+			;
+		po->lcp[i] = k;
+		if (len[t[i].i] > po->max)
+			po->max = len[t[i].i];
+		total += len[t[i].i];
+	}
+	po->lcp[po->n] = 0;
+	/* depths are distinct and not above the length */
+	po->save = malloc((total + 1) * sizeof(int));
+	assert(po->save != NULL);
+	/* running minimum of the following lcp, while it's above our own */
+	for (i = 0; i < po->n; i++) {
+		po->nsave[i] = ns;
+		for (k = i + 1, m = po->max + 1; k < po->n && po->lcp[k] > po->lcp[i]; k++)
+			if (po->lcp[k] < m)
+				po->save[ns++] = m = po->lcp[k];
+		/* ascending */
+		for (k = po->nsave[i], m = ns - 1; k < m; k++, m--) {
+			int x = po->save[k];
+			po->save[k] = po->save[m];
+			po->save[m] = x;
+		}
+	}
+	po->nsave[po->n] = ns;
+	free(t);
+	return po;
+}
+
+/*
+Filters. The original one (rot) sets nh bits anywhere in b[], the i-th
+at ROR(h, i * shift) % m, one cache line and one division per bit. For a
+32-byte filter that's fine, for megabytes it's nh cache misses per probe.
+
+The blocked one puts all bits of a key into one 64-byte block. Bit i is
+the top 9 bits of h * salt[i], word and bit in the block, for 16 of them
+that's exactly one AVX-512 multiply and shift. The probe loads the block
+once, moves the words into the lanes with one permute (vpermd, two and a
+blend for AVX2) and tests all bits at once. One bit per word (split block,
+as in Parquet) needs no permute, but with 16 words it's k = 16 or a half
+empty block, too many false positives at 10 bits per key.
+
+m is a power of two: positions are masked, no division (rot) and no
+multiply (blocked). Otherwise, rot takes % and blocked maps h on the
+block count with a 32x32->64 multiply.
+*/
+enum { F_ROT, F_BLOCK, F_FUSE8, F_FUSE16 };
+const char *filters[] = { "rot", "block", "fuse8", "fuse16", NULL };
+
+static const uint32_t salt[16] __attribute__((aligned(64))) = {
+	0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d, 0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31,
+	0x9e3779b1, 0x85ebca77, 0xc2b2ae3d, 0x27d4eb2f, 0x165667b1, 0xd3a2646d, 0xfd7046c5, 0xb55a4f09,
+};
+
+static inline void rot_add(uint32_t *b, int m, int nh, int shift, uint32_t h)
+{
+	for (int k = 0; k < nh; k++) {
+		uint32_t p = (m & (m - 1)) ? h % m : h & (m - 1);
+		b[p / 32] |= 1UL << (p % 32);
+		/* we can replace ROR with any other bitmixer */
+		h = ROR(h, shift);
+	}
+}
+
+static inline int rot_probe(const uint32_t *b, int m, int nh, int shift, uint32_t h)
+{
+	int found = 1;
+	for (int k = 0; k < nh; k++) {
+		uint32_t p = (m & (m - 1)) ? h % m : h & (m - 1);
+		found &= b[p / 32] >> (p & 31);
+		h = ROR(h, shift);
+	}
+	return found;
+}
+
+static inline const uint32_t *block_of(const uint32_t *b, int m, uint32_t h)
+{
+	uint32_t nb = m / 512;
+	return b + 16 * ((nb & (nb - 1)) ? (uint32_t)(((uint64_t)h * nb) >> 32) : h & (nb - 1));
+}
+
+static inline void block_add(uint32_t *b, int m, int nh, uint32_t h)
+{
+	uint32_t *w = (uint32_t *)block_of(b, m, h);
+	for (int k = 0; k < nh; k++) {
+		uint32_t p = (h * salt[k]) >> 23;
+		w[p / 32] |= 1U << (p % 32);
+	}
+}
 
-	for (i = 0; needed[i]; i++)
-		needcount++;
+static int block_probe_scalar(const uint32_t *b, int m, int nh, uint32_t h)
+{
+	const uint32_t *w = block_of(b, m, h);
+	int found = 1;
+	for (int k = 0; k < nh; k++) {
+		uint32_t p = (h * salt[k]) >> 23;
+		found &= w[p / 32] >> (p % 32);
+	}
+	return found;
+}
+
+__attribute__((target("avx2")))
+static int block_probe_avx2(const uint32_t *b, int m, int nh, uint32_t h)
+{
+	const uint32_t *w = block_of(b, m, h);
+	__m256i v = _mm256_set1_epi32(h), one = _mm256_set1_epi32(1), k = _mm256_set1_epi32(nh);
+	__m256i b0 = _mm256_load_si256((const __m256i *)w), b1 = _mm256_load_si256((const __m256i *)w + 1);
+	__m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), seven = _mm256_set1_epi32(7);
+	int found = 1;
+	for (int j = 0; j < 2; j++) {
+		__m256i p = _mm256_srli_epi32(_mm256_mullo_epi32(v, _mm256_load_si256((const __m256i *)salt + j)), 23);
+		__m256i i = _mm256_srli_epi32(p, 5);
+		__m256i x = _mm256_blendv_epi8(_mm256_permutevar8x32_epi32(b0, i), _mm256_permutevar8x32_epi32(b1, i),
+			_mm256_cmpgt_epi32(i, seven));
+		/* lanes past nh test nothing */
+		__m256i bit = _mm256_and_si256(_mm256_sllv_epi32(one, _mm256_and_si256(p, _mm256_set1_epi32(31))),
+			_mm256_cmpgt_epi32(k, _mm256_add_epi32(lane, _mm256_set1_epi32(j * 8))));
+		found &= _mm256_testc_si256(x, bit);
+	}
+	return found;
+}
+
+__attribute__((target("avx512f")))
+static int block_probe_avx512(const uint32_t *b, int m, int nh, uint32_t h)
+{
+	const uint32_t *w = block_of(b, m, h);
+	__m512i p = _mm512_srli_epi32(_mm512_mullo_epi32(_mm512_set1_epi32(h), _mm512_load_si512(salt)), 23);
+	__m512i x = _mm512_permutexvar_epi32(_mm512_srli_epi32(p, 5), _mm512_load_si512(w));
+	__m512i bit = _mm512_sllv_epi32(_mm512_set1_epi32(1), _mm512_and_si512(p, _mm512_set1_epi32(31)));
+	return _mm512_mask_testn_epi32_mask((1U << nh) - 1, x, bit) == 0;
+}
+
+static int (*block_probe)(const uint32_t *b, int m, int nh, uint32_t h) = block_probe_scalar;
+
+static void block_select(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		block_probe = block_probe_avx512;
+	else if (__builtin_cpu_supports("avx2"))
+		block_probe = block_probe_avx2;
+}
+
+/*
+Binary fuse filter (Graf, Lemire 2022). For a set that's built once, a
+table of fingerprints where every key has three slots whose xor is its
+fingerprint: 3 memory accesses per probe, no k to choose, and at
+8 bits per fingerprint ~9 bits/key for 0.39% false positives, where Bloom
+needs 11.5. The slots are in three consecutive segments, which is what
+makes the table only 1.125n large (xor filters, slots anywhere, 1.23n).
+
+Build: count the keys in every slot, take the slots with a single key off
+(peel) until nothing is left, then assign fingerprints in reverse. Counts
+go in steps of 4 and the low 2 bits xor which of the three slots it was,
+so the last key in a slot and its position are known without a list.
+Fails on a 2-core in the hypergraph, then it's retried with another seed.
+Keys must be distinct.
+
+In the search the 32-bit string hash is the key, fingerprints go to b[].
+*/
+struct fuse {
+	uint64_t seed;
+	uint32_t seglen, segmask, seglencount, len;
+	int fpbits;		/* 8 or 16 */
+	void *fp;
+};
+
+static inline uint64_t mix64(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static inline void fuse_slots(const struct fuse *f, uint64_t x, uint32_t s[3])
+{
+	s[0] = ((unsigned __int128)x * f->seglencount) >> 64;
+	s[1] = (s[0] + f->seglen) ^ ((x >> 18) & f->segmask);
+	s[2] = (s[0] + 2 * f->seglen) ^ (x & f->segmask);
+}
+
+/* sizes for n keys, returns bytes of fingerprints */
+size_t fuse_init(struct fuse *f, uint32_t n, int fpbits)
+{
+	double l = n > 1 ? log(n) : 0;
+	uint32_t seglen = n > 1 ? 1U << (int)floor(l / log(3.33) + 2.25) : 4;
+	if (seglen > 1 << 18)
+		seglen = 1 << 18;
+	double factor = n > 1 ? fmax(1.125, 0.875 + 0.25 * log(1e6) / l) : 0;
+	uint32_t cap = round(n * factor), segs = (cap + seglen - 1) / seglen;
+	segs = segs <= 2 ? 1 : segs - 2;
+	f->seglen = seglen;
+	f->segmask = seglen - 1;
+	f->seglencount = segs * seglen;
+	f->len = (segs + 2) * seglen;
+	f->fpbits = fpbits;
+	return (size_t)f->len * fpbits / 8;
+}
+
+static inline uint32_t fuse_fp(const struct fuse *f, uint32_t i)
+{
+	return f->fpbits == 8 ? ((uint8_t *)f->fp)[i] : ((uint16_t *)f->fp)[i];
+}
+
+/* fuse_build()'s work arrays, kept between builds, zeroed to start */
+struct fuse_tmp {
+	uint32_t len, n;	/* room for */
+	uint8_t *count, *which;
+	uint64_t *xs;
+	uint32_t *queue, *stack;
+};
+
+static void fuse_tmp_grow(struct fuse_tmp *t, uint32_t len, uint32_t n)
+{
+	if (len > t->len) {
+		t->count = realloc(t->count, len);
+		t->xs = realloc(t->xs, len * sizeof(uint64_t));
+		t->queue = realloc(t->queue, len * sizeof(uint32_t));
+		t->len = len;
+	}
+	if (n + 1 > t->n) {
+		t->stack = realloc(t->stack, (n + 1) * sizeof(uint32_t));
+		t->which = realloc(t->which, n + 1);
+		t->n = n + 1;
+	}
+	assert(t->count != NULL && t->xs != NULL && t->queue != NULL && t->stack != NULL && t->which != NULL);
+}
+
+void fuse_tmp_free(struct fuse_tmp *t)
+{
+	free(t->count);
+	free(t->xs);
+	free(t->queue);
+	free(t->stack);
+	free(t->which);
+	*t = (struct fuse_tmp){ 0 };
+}
+
+/* fingerprints go to f->fp, 0 or -1 if no seed works, t is grown as needed */
+int fuse_build(struct fuse *f, const uint32_t *keys, uint32_t n, struct fuse_tmp *t)
+{
+	fuse_tmp_grow(t, f->len, n);
+	uint8_t *count = t->count, *which = t->which;
+	uint64_t *xs = t->xs;
+	uint32_t *queue = t->queue, *stack = t->stack;
+	uint64_t rng = 0x726f746174696f6eULL;
+	uint32_t i, s[3];
+	int tries, ret = -1;
+	for (tries = 0; tries < 100 && ret; tries++) {
+		f->seed = mix64(rng += 0x9E3779B97F4A7C15ULL);
+		memset(count, 0, f->len);
+		memset(xs, 0, f->len * sizeof(uint64_t));
+		for (i = 0; i < n; i++) {
+			uint64_t x = mix64(keys[i] ^ f->seed);
+			fuse_slots(f, x, s);
+			for (int j = 0; j < 3; j++) {
+				count[s[j]] += 4;
+				count[s[j]] ^= j;
+				xs[s[j]] ^= x;
+			}
+		}
+		uint32_t q = 0, top = 0;
+		for (i = 0; i < f->len; i++)
+			if (count[i] >> 2 == 1)
+				queue[q++] = i;
+		while (q) {
+			uint32_t k = queue[--q];
+			if (count[k] >> 2 != 1)
+				continue;
+			uint64_t x = xs[k];
+			int found = count[k] & 3;
+			stack[top] = k;
+			which[top++] = found;
+			fuse_slots(f, x, s);
+			for (int j = 0; j < 3; j++) {
+				if (j == found)
+					continue;
+				count[s[j]] -= 4;
+				count[s[j]] ^= j;
+				xs[s[j]] ^= x;
+				if (count[s[j]] >> 2 == 1)
+					queue[q++] = s[j];
+			}
+			count[k] = 0;
+		}
+		if (top != n)
+			continue;
+		/* assign in reverse, the slot taken last is free to set */
+		memset(f->fp, 0, (size_t)f->len * f->fpbits / 8);
+		while (top--) {
+			uint32_t k = stack[top];
+			uint64_t x = xs[k];
+			uint32_t v = x ^ x >> 32;
+			fuse_slots(f, x, s);
+			for (int j = 0; j < 3; j++)
+				if (j != which[top])
+					v ^= fuse_fp(f, s[j]);
+			if (f->fpbits == 8)
+				((uint8_t *)f->fp)[k] = v;
+			else
+				((uint16_t *)f->fp)[k] = v;
+		}
+		ret = 0;
+	}
+	return ret;
+}
+
+static inline int fuse_probe(const struct fuse *f, uint32_t h)
+{
+	uint64_t x = mix64(h ^ f->seed);
+	uint32_t s[3], v = x ^ x >> 32;
+	fuse_slots(f, x, s);
+	if (f->fpbits == 8)
+		return (uint8_t)(v ^ ((uint8_t *)f->fp)[s[0]] ^ ((uint8_t *)f->fp)[s[1]] ^ ((uint8_t *)f->fp)[s[2]]) == 0;
+	return (uint16_t)(v ^ ((uint16_t *)f->fp)[s[0]] ^ ((uint16_t *)f->fp)[s[1]] ^ ((uint16_t *)f->fp)[s[2]]) == 0;
+}
+
+/* murmur3 finalizer, a bijection, so keys and non-keys never meet */
+static inline uint32_t fmix(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	return h ^ h >> 16;
+}
+
+/*
+False positives and ns per probe, random 32-bit hashes instead of strings.
+Bloom filters get 10 bits per key, power of two sizes and the same sizes
++1/4 to see what the division (rot) and the multiply (blocked) cost. Fuse
+filters take the same keys and as much space as they need.
+*/
+void filter_bench(int nh, int shift)
+{
+	int q = 1 << 22, i, s;
+	const char *names[] = { "rot", "block", "block avx2", "block avx512", "fuse8", "fuse16" };
+	__builtin_cpu_init();
+	printf("%-12s %-14s %8s %9s %8s\n", "bits", "filter", "bits/key", "fpr", "ns/op");
+	for (s = 16; s <= 28; s += 4) {
+		for (int odd = 0; odd < 2; odd++) {
+			int m = (1 << s) + (odd ? 1 << (s - 2) : 0), n = m / 10, e;
+			uint32_t *b = NULL, *keys = NULL;
+			struct fuse_tmp tmp = { 0 };
+			if (posix_memalign((void **)&b, 64, m / 8))
+				b = NULL;
+			assert(b != NULL);
+			for (e = 0; e < 6; e++) {
+				int (*probe)(const uint32_t *, int, int, uint32_t) = NULL;
+				size_t bytes = m / 8;
+				struct fuse f;
+				if ((e == 2 && !__builtin_cpu_supports("avx2")) || (e == 3 && !__builtin_cpu_supports("avx512f")))
+					continue;
+				if (e > 0 && e < 4 && nh > 16)
+					continue;
+				/* fuse: the same keys, its own size */
+				if (e >= 4 && odd)
+					continue;
+				probe = e == 1 ? block_probe_scalar : e == 2 ? block_probe_avx2 : block_probe_avx512;
+				bzero(b, m / 8);
+				if (e < 4) {
+					for (i = 0; i < n; i++)
+						if (e == 0)
+							rot_add(b, m, nh, shift, fmix(i));
+						else
+							block_add(b, m, nh, fmix(i));
+				} else {
+					bytes = fuse_init(&f, n, e == 4 ? 8 : 16);
+					f.fp = malloc(bytes);
+					if (keys == NULL) {
+						keys = malloc(n * sizeof(uint32_t));
+						assert(keys != NULL);
+						for (i = 0; i < n; i++)
+							keys[i] = fmix(i);
+					}
+					assert(f.fp != NULL);
+					if (fuse_build(&f, keys, n, &tmp) < 0) {
+						printf("%-12d %-14s build failed\n", m, names[e]);
+						free(f.fp);
+						continue;
+					}
+				}
+				int fp = 0;
+				double t0 = now();
+				if (e == 0)
+					for (i = 0; i < q; i++)
+						fp += rot_probe(b, m, nh, shift, fmix(n + i));
+				else if (e < 4)
+					for (i = 0; i < q; i++)
+						fp += probe(b, m, nh, fmix(n + i));
+				else
+					for (i = 0; i < q; i++)
+						fp += fuse_probe(&f, fmix(n + i));
+				double t = now() - t0;
+				printf("%-12d %-14s %8.2f %9.6f %8.2f\n", m, names[e], bytes * 8.0 / n, (double)fp / q, t / q * 1e9);
+				if (e >= 4) {
+					/* no false negatives */
+					for (i = 0; i < n; i++)
+						assert(fuse_probe(&f, keys[i]));
+					free(f.fp);
+				}
+			}
+			fuse_tmp_free(&tmp);
+			free(keys);
+			free(b);
+		}
+	}
+}
+
+struct insn {
+	unsigned op, arg;
+};
+
+/*
+Search state. Strings and parameters are shared and read only, everything
+the loop writes to is per thread: RNG stream, H[], the filter, the fuse
+build arrays and the JIT page. Found programs go to found() under the
+lock, nothing else is shared but the candidate counter.
+*/
+struct search {
+	/* shared */
+	char **list;
+	int *len, n;
+	int shift, nh, bloom_size, size, engine, filter;
+	struct tlayout *tl;	/* strings not in needed[] */
+	struct tlayout *tla;	/* all of them, for score() */
+	int *need, nneed;	/* indices of needed[] in the list */
+	uint32_t *isneed;	/* and the same as bitmap */
+	struct porder *po;	/* the same strings, for the scalar engines */
+	struct insn *alpha;	/* -x: insns to enumerate */
+	int nalpha, *next;	/* -x: next first insn to take */
+	long limit, *total;
+	/* per thread */
+	uint64_t rng;
+	unsigned *H;
+	uint32_t *S;		/* 2n, for score() */
+	uint32_t b[1024] __attribute__((aligned(64)));
+	struct fuse fuse;	/* -F fuse*, fingerprints in b[] */
+	struct fuse_tmp fuse_tmp;	/* and its build arrays */
+	uint8_t *code;
+	long cand;
+	/* -S: found() keeps the sparsest filter instead of printing */
+	int quiet, hits, best;
+	unsigned best_prog[32], best_args[32];
+};
+
+/*
+Scoring. No collisions in the filter says nothing about the hash itself,
+and the same program may be reused on a larger set. For every accepted
+program, all the strings are hashed (the vector engine, if any) and:
+
+unique: distinct values, radix sorted (4 passes of 8 bits) and the
+neighbours compared, instead of comparing every pair.
+
+avalanche: one bit of one char flipped in 16 strings at once, the
+fraction of the 32 output bits that changed (0.5 is ideal), and the
+worst bias of a single output bit (0 ideal, 1 it never or always flips).
+
+chi2: the low and the high bits as buckets, n/8 strings per bucket on
+average, chi2 / degrees of freedom for the worse of the two (1 is ideal,
+the filter takes h % m, so the low bits matter more).
+*/
+struct score {
+	int unique;
+	double aval, bias, chi;
+};
+
+/* one group of the transposed layout, any engine */
+static void hash_group(int engine, hash_fn fn, unsigned *prog, unsigned *args, int size,
+	const int8_t *col, int len, uint32_t *out)
+{
+	if (engine == E_AVX512) {
+		hash_avx512(prog, args, size, col, len, out);
+	} else if (engine == E_AVX2) {
+		hash_avx2(prog, args, size, col, len, out);
+	} else {
+		char s[len + 1];
+		for (int lane = 0; lane < LANES; lane++) {
+			for (int j = 0; j < len; j++)
+				s[j] = col[j * LANES + lane];
+			out[lane] = fn ? fn(s, len, 0) : hash_interp(prog, args, size, s, len, 0);
+		}
+	}
+}
+
+static void radix_sort(uint32_t *a, uint32_t *tmp, int n)
+{
+	for (int shift = 0; shift < 32; shift += 8) {
+		int c[257] = { 0 }, i;
+		for (i = 0; i < n; i++)
+			c[((a[i] >> shift) & 255) + 1]++;
+		for (i = 1; i < 256; i++)
+			c[i] += c[i - 1];
+		for (i = 0; i < n; i++)
+			tmp[c[(a[i] >> shift) & 255]++] = a[i];
+		memcpy(a, tmp, n * sizeof(uint32_t));
+	}
+}
+
+static double chi2(const uint32_t *H, int n, int k, int high)
+{
+	int nb = 1 << k, c[nb], i;
+	double e = (double)n / nb, s = 0;
+	memset(c, 0, sizeof(c));
+	for (i = 0; i < n; i++)
+		c[high ? H[i] >> (32 - k) : H[i] & (nb - 1)]++;
+	for (i = 0; i < nb; i++)
+		s += (c[i] - e) * (c[i] - e) / e;
+	return s / (nb - 1);
+}
+
+void score(struct search *st, unsigned *prog, unsigned *args, struct score *sc)
+{
+	struct tlayout *tl = st->tla;
+	hash_fn fn = st->code ? jit(st->code, prog, args, st->size) : NULL;
+	uint32_t *H = st->S, *tmp = st->S + st->n, out0[LANES], out1[LANES];
+	int n = st->n, i, j, k, lane;
+
+	hash_all(st->engine, tl, st->code, st->list, st->len, n, prog, args, st->size, H);
+	for (k = 1; (n >> (k + 1)) >= 8 && k < 16; k++)
+		;
+	double lo = chi2(H, n, k, 0), hi = chi2(H, n, k, 1);
+	sc->chi = lo > hi ? lo : hi;
+
+	radix_sort(H, tmp, n);
+	for (i = 0, sc->unique = 0; i < n; i++)
+		sc->unique += i == 0 || H[i] != H[i - 1];
+
+	long flips = 0, changed = 0, perbit[32] = { 0 };
+	for (i = 0; i < tl->ng; i++) {
+		struct group *g = &tl->g[i];
+		if (g->len == 0)
+			continue;
+		int8_t buf[g->len * LANES];
+		hash_group(st->engine, fn, prog, args, st->size, tl->chars + g->off, g->len, out0);
+		for (int f = 0; f < 4; f++) {
+			int pos = rnd(&st->rng) % g->len, bit = rnd(&st->rng) % 7;
+			memcpy(buf, tl->chars + g->off, sizeof(buf));
+			for (lane = 0; lane < LANES; lane++)
+				buf[pos * LANES + lane] ^= 1 << bit;
+			hash_group(st->engine, fn, prog, args, st->size, buf, g->len, out1);
+			for (lane = 0; lane < LANES && g->idx[lane] >= 0; lane++) {
+				uint32_t d = out0[lane] ^ out1[lane];
+				changed += __builtin_popcount(d);
+				for (j = 0; j < 32; j++)
+					perbit[j] += (d >> j) & 1;
+				flips++;
+			}
+		}
+	}
+	sc->aval = flips ? changed / (32.0 * flips) : 0;
+	for (j = 0, sc->bias = 0; j < 32 && flips; j++) {
+		double b = fabs(2.0 * perbit[j] / flips - 1);
+		if (b > sc->bias)
+			sc->bias = b;
+	}
+}
+
+static pthread_mutex_t sink = PTHREAD_MUTEX_INITIALIZER;
+
+/* thread-safe result sink */
+void found(struct search *st, unsigned *prog, unsigned *args, int collisions)
+{
+	struct score sc;
+	int i, c = 0, fuse = st->filter == F_FUSE8 || st->filter == F_FUSE16;
+	int words = fuse ? (st->fuse.len * st->fuse.fpbits + 31) / 32 : st->bloom_size / 32;
+	for (i = 0; i < words; i++)
+		c += __builtin_popcount(st->b[i]);
+	if (st->quiet) {
+		if (st->hits++ == 0 || c < st->best) {
+			st->best = c;
+			memcpy(st->best_prog, prog, st->size * sizeof(unsigned));
+			memcpy(st->best_args, args, st->size * sizeof(unsigned));
+		}
+		return;
+	}
+	score(st, prog, args, &sc);
+	pthread_mutex_lock(&sink);
+	if (fuse) {
+		int bytes = st->fuse.len * st->fuse.fpbits / 8;
+		printf("%d bytes, fuse%d, %d coll., %d unique, aval %.3f, bias %.3f, chi2 %.2f %016lx ", bytes, st->fuse.fpbits,
+			collisions, sc.unique, sc.aval, sc.bias, sc.chi, st->fuse.seed);
+		for (i = 0; i < bytes; i++)
+			printf("%02x", ((uint8_t *)st->b)[i]);
+	} else {
+		printf("%d bytes, %d hashes, %-3d bits, %d coll., %d unique, aval %.3f, bias %.3f, chi2 %.2f ", st->bloom_size / 8,
+			st->nh, c, collisions, sc.unique, sc.aval, sc.bias, sc.chi);
+		for (i = 0; i < st->bloom_size / 32; i++)
+			printf("%08x", st->b[i]);
+	}
+	printf(" ");
+	for (i = 0; i < st->size; i++)
+		printf(ops[prog[i]], args[i]);
+	printf("\n");
+	fflush(stdout);
+	pthread_mutex_unlock(&sink);
+}
+
+/*
+Number of strings not in needed[] the filter says yes to, counting stops
+at the first one. Filter is made of the needed strings only, so build it
+first and then check the rest. Most of the candidates are rejected after
+a few strings.
+*/
+int check(struct search *st, unsigned *prog, unsigned *args)
+{
+	char **list = st->list;
+	int *len = st->len, size = st->size, nh = st->nh, shift = st->shift;
+	int bloom_size = st->bloom_size;
+	unsigned *H = st->H;
+	uint32_t *b = st->b;
+	int i, k, blocked = st->filter == F_BLOCK, fuse = st->filter == F_FUSE8 || st->filter == F_FUSE16;
+	uint32_t keys[st->nneed ? st->nneed : 1];
+
+	bzero(b, bloom_size / 8);
+	hash_fn fn = st->code ? jit(st->code, prog, args, size) : NULL;
+	for (i = 0; i < st->nneed; i++) {
+		int x = st->need[i];
+		uint32_t h = fn ? fn(list[x], len[x], 0) : hash_interp(prog, args, size, list[x], len[x], 0);
+		H[x] = h;
+		/* add string into filter */
+		if (fuse)
+			keys[i] = h;
+		else if (blocked)
+			block_add(b, bloom_size, nh, h);
+		else
+			rot_add(b, bloom_size, nh, shift, h);
+	}
+	if (fuse) {
+		/* needed strings with the same hash are one key */
+		int n = 0;
+		for (i = 0; i < st->nneed; i++) {
+			for (k = 0; k < n && keys[k] != keys[i]; k++)
+				;
+			if (k == n)
+				keys[n++] = keys[i];
+		}
+		st->fuse.fp = b;
+		fuse_init(&st->fuse, n, st->filter == F_FUSE8 ? 8 : 16);
+		if (fuse_build(&st->fuse, keys, n, &st->fuse_tmp) < 0)
+			return 1;
+	}
+
+	/* check for collisions */
+	int collisions = 0;
+	int probe(uint32_t h) {
+		if (fuse)
+			return fuse_probe(&st->fuse, h);
+		return blocked ? block_probe(b, bloom_size, nh, h) : rot_probe(b, bloom_size, nh, shift, h);
+	}
+	if (st->engine == E_AVX2 || st->engine == E_AVX512) {
+		struct tlayout *tl = st->tl;
+		uint32_t out[LANES];
+		for (i = 0; i < tl->ng && !collisions; i++) {
+			struct group *g = &tl->g[i];
+			if (st->engine == E_AVX512)
+				hash_avx512(prog, args, size, tl->chars + g->off, g->len, out);
+			else
+				hash_avx2(prog, args, size, tl->chars + g->off, g->len, out);
+			for (k = 0; k < LANES && g->idx[k] >= 0; k++) {
+				H[g->idx[k]] = out[k];
+				collisions += probe(out[k]);
+			}
+		}
+	} else {
+		/* scalar, sorted order, starting from the shared prefix */
+		struct porder *po = st->po;
+		uint32_t state[po->max + 1];
+		state[0] = 0;
+		for (i = 0; i < po->n && !collisions; i++) {
+			int x = po->idx[i], from = po->lcp[i];
+			uint32_t h = state[from];
+			for (k = po->nsave[i]; k < po->nsave[i + 1]; k++) {
+				int to = po->save[k];
+				h = fn ? fn(list[x] + from, to - from, h) : hash_interp(prog, args, size, list[x] + from, to - from, h);
+				state[from = to] = h;
+			}
+			h = fn ? fn(list[x] + from, len[x] - from, h) : hash_interp(prog, args, size, list[x] + from, len[x] - from, h);
+			H[x] = h;
+			collisions += probe(h);
+		}
+	}
+	return collisions;
+}
+
+void *search(void *arg)
+{
+	struct search *st = arg;
+	int i, size = st->size;
+	unsigned int prog[32];
+	unsigned int args[32];
 
 	for (;;) {
+		if (st->limit && __atomic_fetch_add(st->total, 1, __ATOMIC_RELAXED) >= st->limit)
+			break;
+		st->cand++;
 		/* at least one instruction should mix char into hash */
-		int cp1 = random() % size;
+		int cp1 = rnd(&st->rng) % size;
 		for (i = 0; i < size; i++) {
 			if (i == cp1) {
-				prog[i] = random() % 6;
+				prog[i] = rnd(&st->rng) % 6;
 			} else {
-				prog[i] = 0x10 + (random() % 16);
-				args[i] = (1 + random()) & 0x1f;
+				prog[i] = 0x10 + (rnd(&st->rng) % 16);
+				args[i] = (1 + rnd(&st->rng)) & 0x1f;
 			}
 		} // prog
 
-		bzero(b, sizeof(b));
+		int collisions = check(st, prog, args);
+		if (collisions == 0)
+			found(st, prog, args, collisions);
+	}
+	return NULL;
+}
 
-		for (i = 0; i < n; i++) {
-			char *s = list[i];
-			uint32_t h = 0;
-			for (j = 0; j < len[i]; j++) {
-				unsigned c = s[j];
-				for (k = 0; k < size; k++)
-					switch (prog[k]) {
-						case 0:		h += c;			break;
-						case 1: 	h -= c;			break;
-						case 2: 	h *= c;			break;
-						case 3: 	h ^= c;			break;
-						case 4: 	h |= c;			break;
-						case 5: 	h &= c;			break;
-
-						case 0x10:	h += h << args[k];	break;
-						case 0x11:	h -= h << args[k];	break;
-						case 0x12:	h *= h << args[k];	break;
-						case 0x13:	h ^= h << args[k];	break;
-						case 0x14:	h += h >> args[k];	break;
-						case 0x15:	h -= h >> args[k];	break;
-						case 0x16:	h *= h >> args[k];	break;
-						case 0x17:	h ^= h >> args[k];	break;
-						case 0x18:	h = ROL(h, args[k]);	break;
-						case 0x19:	h = ROR(h, args[k]);	break;
-						case 0x1a:	h += args[k];		break;
-						case 0x1b:	h -= args[k];		break;
-						case 0x1c:	h *= args[k];		break;
-						case 0x1d:	h ^= args[k];		break;
-						case 0x1e:	h |= args[k];		break;
-						case 0x1f:	h &= args[k];		break;
-					}
-			} // chars
-			H[i] = h;
-
-			for (j = 0; needed[j]; j++) {
-				if (! strcmp(list[i], needed[j])) {
-					/* add string into filter */
-					for (k = 0; k < nh; k++) {
-						int p = h % bloom_size;
-						b[p / 32] |= 1UL << (p % 32);
-						/* we can replace ROR with any other bitmixer */
-						h = ROR(h, shift);
-					}
+/*
+Exhaustive mode (-x). Instead of drawing programs at random, walk all of
+them as a tree, insn by insn, one mixer per program, like the random ones.
+Whole subtrees are cut off where the insn is useless or the prefix can
+be written shorter:
+
+	h &= c		keeps the bits of one char
+	h &= x		keeps 5 bits
+	h *= h << x	keeps 32-x bits of the square, cut for x > 20
+	h *= h >> x	zero for every h below 2^x, cut for x > 20
+	h >>= x		is h <<= 32-x
+	op 0, *= 1	no-op or zero
+	h <<= x; h <<= y	one rotate
+	h ^= x; h ^= y	one xor, the same for |=
+	h += x; h -= y	one add or sub, or two adds if x+y < 32
+
+The first level is shared between threads.
+*/
+int alphabet(struct insn *a)
+{
+	int n = 0;
+	unsigned op, x;
+	for (op = 0; op < 5; op++)
+		a[n++] = (struct insn){ op, 0 };
+	for (op = 0x10; op < 0x1f; op++) {
+		if (op == 0x19)
+			continue;
+		for (x = 1; x < 32; x++) {
+			if ((op == 0x12 || op == 0x16) && x > 20)
+				continue;
+			if (op == 0x1c && x == 1)
+				continue;
+			a[n++] = (struct insn){ op, x };
+		}
+	}
+	return n;
+}
+
+static int redundant(unsigned p, unsigned x, unsigned q, unsigned y)
+{
+	if (p == q && (p == 0x18 || p == 0x1d || p == 0x1e))
+		return 1;
+	if ((p == 0x1a && q == 0x1b) || (p == 0x1b && q == 0x1a))
+		return 1;
+	return p == q && (p == 0x1a || p == 0x1b) && x + y < 32;
+}
+
+/* returns 1 when the limit is reached */
+static int walk(struct search *st, unsigned *prog, unsigned *args, int depth, int mixed)
+{
+	int t;
+	if (depth == st->size) {
+		if (st->limit && __atomic_fetch_add(st->total, 1, __ATOMIC_RELAXED) >= st->limit)
+			return 1;
+		st->cand++;
+		if (check(st, prog, args) == 0)
+			found(st, prog, args, 0);
+		return 0;
+	}
+	for (t = 0; t < st->nalpha; t++) {
+		struct insn *i = &st->alpha[t];
+		int mix = i->op < 0x10;
+		/* exactly one mixer */
+		if (mix ? mixed : !mixed && depth == st->size - 1)
+			continue;
+		if (depth && redundant(prog[depth - 1], args[depth - 1], i->op, i->arg))
+			continue;
+		prog[depth] = i->op;
+		args[depth] = i->arg;
+		if (walk(st, prog, args, depth + 1, mixed | mix))
+			return 1;
+	}
+	return 0;
+}
+
+void *enumerate(void *arg)
+{
+	struct search *st = arg;
+	unsigned int prog[32];
+	unsigned int args[32];
+	int t;
+
+	while ((t = __atomic_fetch_add(st->next, 1, __ATOMIC_RELAXED)) < st->nalpha) {
+		struct insn *i = &st->alpha[t];
+		if (st->size == 1 && i->op >= 0x10)
+			continue;
+		prog[0] = i->op;
+		args[0] = i->arg;
+		if (walk(st, prog, args, 1, i->op < 0x10))
+			break;
+	}
+	return NULL;
+}
+
+/* runs fn on st[0..nth), returns the candidates, *t is the time; the work is shared, so threads that don't start are left out */
+long run(struct search *st, int nth, void *(*fn)(void *), double *t)
+{
+	pthread_t th[nth];
+	int i, started;
+	double t0 = now();
+	for (started = 1; started < nth; started++)
+		if (pthread_create(&th[started], NULL, fn, &st[started]) != 0)
+			break;
+	fn(&st[0]);
+	long cand = st[0].cand;
+	for (i = 1; i < started; i++) {
+		pthread_join(th[i], NULL);
+		cand += st[i].cand;
+	}
+	*t = now() - t0;
+	return cand;
+}
+
+/*
+Sweep (-S). For every program length, hash count and rotation the filter
+is halved while -n candidates still find a collision-free program, from
+2048 bits (4096 for blocked). Every step prints the throughput, hits and
+the sparsest filter found. At the end, the Pareto front of filter bytes
+against the cost of the decoder, size * average name length insns per
+name to hash it, plus nh probes.
+*/
+struct point {
+	int bits, nh, shift, size, hits, best;
+	double rate, cost;
+	unsigned prog[32], args[32];
+};
+
+void sweep(struct search *st, int nth, void *(*fn)(void *), double avglen)
+{
+	static const int sizes[] = { 2, 3 }, nhs[] = { 3, 5, 7, 9, 11, 13 }, shifts[] = { 7, 13, 19 };
+	int fuse = st->filter == F_FUSE8 || st->filter == F_FUSE16, blocked = st->filter == F_BLOCK;
+	int a, b, c, i, j, bits, np = 0;
+	struct point *pt = NULL;
+
+	printf("%6s %3s %5s %4s %10s %6s %5s\n", "bits", "nh", "shift", "size", "cand/s", "hits", "best");
+	for (a = 0; a < 2; a++)
+	for (b = 0; b < 6; b++)
+	for (c = 0; c < 3; c++) {
+		/* fuse has no nh and no size, blocked no rotation */
+		if ((fuse && (b || c)) || (blocked && c))
+			continue;
+		for (bits = blocked ? 4096 : 2048; bits >= (blocked ? 512 : 32); bits /= 2) {
+			struct point p = { bits, fuse ? 3 : nhs[b], shifts[c], sizes[a] };
+			*st->total = 0;
+			*st->next = 0;
+			for (i = 0; i < nth; i++) {
+				st[i].bloom_size = bits;
+				st[i].nh = p.nh;
+				st[i].shift = p.shift;
+				st[i].size = p.size;
+				st[i].cand = st[i].hits = 0;
+				st[i].quiet = 1;
+			}
+			double t;
+			long cand = run(st, nth, fn, &t);
+			p.rate = cand / t;
+			p.cost = p.size * avglen + p.nh;
+			for (i = 0; i < nth; i++) {
+				if (st[i].hits && (p.hits == 0 || st[i].best < p.best)) {
+					p.best = st[i].best;
+					memcpy(p.prog, st[i].best_prog, sizeof(p.prog));
+					memcpy(p.args, st[i].best_args, sizeof(p.args));
 				}
+				p.hits += st[i].hits;
 			}
-		} // strings
+			if (fuse) {
+				struct fuse f;
+				p.bits = fuse_init(&f, st->nneed, st->filter == F_FUSE8 ? 8 : 16) * 8;
+			}
+			printf("%6d %3d %5d %4d %10.0f %6d %5d\n", p.bits, p.nh, p.shift, p.size, p.rate, p.hits, p.best);
+			fflush(stdout);
+			if (p.hits == 0)
+				break;
+			pt = realloc(pt, (np + 1) * sizeof(struct point));
+			assert(pt != NULL);
+			pt[np++] = p;
+			if (fuse)
+				break;
+		}
+	}
 
-		int unique = 0;
-#if	0
-		for (i = 0; i < n; i++) {
-			int exists = 0;
-			for (j = i - 1; j >= 0; j--) {
-				if (H[i] == H[j]) {
-					exists = 1;
-					break;
-				}
+	/* by size, then by cost; a point is on the front when it's cheaper than all smaller ones */
+	for (i = 1; i < np; i++)
+		for (j = i; j > 0 && (pt[j].bits < pt[j - 1].bits ||
+		    (pt[j].bits == pt[j - 1].bits && pt[j].cost < pt[j - 1].cost)); j--) {
+			struct point x = pt[j];
+			pt[j] = pt[j - 1];
+			pt[j - 1] = x;
+		}
+	printf("\nPareto front, %.1f chars per name\n%6s %8s %3s %5s %4s %10s  %s\n", avglen,
+		"bytes", "cost", "nh", "shift", "size", "cand/s", "program");
+	double min = 1e30;
+	for (i = 0; i < np; i++) {
+		if (pt[i].cost >= min)
+			continue;
+		min = pt[i].cost;
+		printf("%6d %8.1f %3d %5d %4d %10.0f  ", pt[i].bits / 8, pt[i].cost, pt[i].nh, pt[i].shift, pt[i].size, pt[i].rate);
+		for (j = 0; j < pt[i].size; j++)
+			printf(ops[pt[i].prog[j]], pt[i].args[j]);
+		printf("\n");
+	}
+	free(pt);
+}
+
+int main(int argc, char **argv)
+{
+	/*
+	-e engine (-i is -e interp), -n to stop after n candidates, -b to benchmark engines, -x exhaustive,
+	strings from -l list and -E elf (.dynsym), any number of them, list.txt if none,
+	-F rot|block|fuse8|fuse16 filter of -m bits with -k hashes rotated by -r, -B to benchmark filters,
+	-s insns per program, -S to sweep all of these
+	*/
+	int opt, engine = best_engine(), nth = 1, bench_only = 0, exhaustive = 0, filter = F_ROT, sweeping = 0;
+	long limit = 0, total = 0;
+	struct strset ss;
+	strset_init(&ss);
+
+	/* bloom filter parameters */
+	int shift = 7;
+	int nh = 11;
+	int bloom_size = 256;
+
+	/* number of hash insns */
+	int size = 3;
+
+	while ((opt = getopt(argc, argv, "ie:n:t:bxl:E:F:m:k:Br:s:S")) != -1)
+		switch (opt) {
+		case 'r':
+			shift = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'S':
+			sweeping = 1;
+			break;
+		case 'F':
+			for (filter = 0; filters[filter] && strcmp(filters[filter], optarg); filter++)
+				;
+			if (filters[filter] == NULL) {
+				printf("Unknown filter %s\n", optarg);
+				return 2;
 			}
-			if (!exists) 
-				unique++;
-    		}
-#endif
-		/* check for collisions */
-		int collisions = 0, count = 0;
-		for (i = 0; i < n; i++) {
-			uint32_t h = H[i];
-			/* check filter */
-			int found = 1;
-			for (j = 0; j < nh; j++) {
-				int p = h % bloom_size;
-				found &= b[p / 32] >> (p & 31);
-				h = ROR(h, shift);
+			break;
+		case 'm':
+			bloom_size = atoi(optarg);
+			break;
+		case 'k':
+			nh = atoi(optarg);
+			break;
+		case 'B':
+			bench_only = 2;
+			break;
+		case 'l':
+			if (strset_load_list(&ss, optarg) < 0) {
+				perror(optarg);
+				return 2;
 			}
-			if (found) {
-				int match = 0;
-				for (j = 0; needed[j]; j++)
-					if (! strcmp(needed[j], list[i])) {
-						match = 1;
-						break;
-					}
-				if (match == 0)
-					collisions++;
-				else {
-					count++;
-				}
+			break;
+		case 'E':
+			if (strset_load_elf(&ss, optarg) < 0) {
+				perror(optarg);
+				return 2;
 			}
+			break;
+		case 'i':
+			engine = E_INTERP;
+			break;
+		case 'e':
+			for (engine = 0; engines[engine] && strcmp(engines[engine], optarg); engine++)
+				;
+			if (engines[engine] == NULL) {
+				printf("Unknown engine %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'b':
+			bench_only = 1;
+			break;
+		case 'x':
+			exhaustive = 1;
+			break;
+		case 'n':
+			limit = atol(optarg);
+			break;
+		case 't':
+			nth = atoi(optarg);
+			if (nth < 1)
+				nth = 1;
+			break;
+		default:
+			printf("Usage: %s [-i|-e interp|jit|avx2|avx512] [-n candidates] [-t threads] [-b] [-x] [-l list] [-E elf] "
+				"[-F rot|block|fuse8|fuse16] [-m bits] [-k hashes] [-r shift] [-s size] [-B] [-S]\n", argv[0]);
+			return 2;
 		}
+	/* b[] is 32k bits, blocks are 512 bits, fuse filters are sized by the keys */
+	if (!sweeping && filter < F_FUSE8 && (bloom_size < 32 || bloom_size > 32768 || bloom_size % (filter == F_BLOCK ? 512 : 32) ||
+	    nh < 1 || (filter == F_BLOCK && nh > 16))) {
+		printf("Bad filter size %d or hash count %d\n", bloom_size, nh);
+		return 2;
+	}
+	if (shift < 1 || shift > 31 || size < 1 || size > 32) {
+		printf("Bad rotation %d or program size %d\n", shift, size);
+		return 2;
+	}
+	block_select();
+	if (bench_only == 2) {
+		filter_bench(nh, shift);
+		return 0;
+	}
 
-		if (collisions == 0) { // && count == needcount
-#if	0
-			for (i = 0; i < n; i++) {
-				uint32_t h = H[i];
-				/* check filter */
-				int found = 1;
-				for (j = 0; j < nh; j++) {
-					int p = h % bloom_size;
-					found &= b[p / 32] >> (p & 31);
-					h = ROR(h, shift);
-				}
-				if (found)
-					printf("%s ", list[i]);
-			}
-#endif
-			int c = 0;
-			for (i = 0; i < bloom_size / 32; i++)
-				c += __builtin_popcount(b[i]);
-			printf("%d bytes, %d hashes, %-3d bits, %d coll., %d unique ", bloom_size / 8, nh, c, collisions, unique);
-			for (i = 0; i < bloom_size / 32; i++)
-				printf("%08x", b[i]);
-			printf(" ");
-			for (i = 0; i < size; i++)
-				printf(ops[prog[i]], args[i]);
-			printf("\n");
+	int i;
+
+	/* read strings */
+	if (ss.n == 0 && strset_load_list(&ss, "list.txt") < 0) {
+		printf("Failed to open list.txt\n");
+		return 2;
+	}
+	i = strset_done(&ss);
+	assert(i == 0);
+	int n = ss.n, *len = ss.len;
+	char **list = ss.s;
+
+	if (bench_only == 1) {
+		bench(transpose(list, len, n, NULL), list, len, n, size);
+		return 0;
+	}
+
+	/* membership is known at load time */
+	int *need = malloc(sizeof(needed)), nneed = 0;
+	uint32_t *isneed = calloc(n / 32 + 1, sizeof(uint32_t));
+	assert(need != NULL && isneed != NULL);
+	for (i = 0; needed[i]; i++) {
+		int x = strset_find(&ss, needed[i], strlen(needed[i]));
+		if (x < 0) {
+			printf("%s is not in the list\n", needed[i]);
+			continue;
 		}
+		need[nneed++] = x;
+		isneed[x / 32] |= 1U << (x % 32);
+	}
+	struct tlayout *tl = transpose(list, len, n, isneed), *tla = transpose(list, len, n, NULL);
+	struct porder *po = prefix_order(list, len, n, isneed);
+	struct insn alpha[512];
+	int nalpha = alphabet(alpha), next = 0;
+
+	struct search st[nth];
+	uint64_t seed = time(NULL);
+	for (i = 0; i < nth; i++) {
+		st[i] = (struct search){ list, len, n, shift, nh, bloom_size, size, engine, filter, tl, tla,
+			need, nneed, isneed, po, alpha, nalpha, &next, limit, &total };
+		/* distinct non-zero streams */
+		st[i].rng = (seed + i + 1) * 0x9E3779B97F4A7C15ULL;
+		st[i].H = malloc(n * sizeof(int));
+		st[i].S = malloc(2 * n * sizeof(uint32_t));
+		assert(st[i].H != NULL && st[i].S != NULL);
+		st[i].code = engine != E_INTERP ? jit_alloc() : NULL;
+		if (engine == E_JIT && st[i].code == NULL && i == 0)
+			printf("No JIT, using interpreter\n");
+	}
+
+	void *(*fn)(void *) = exhaustive ? enumerate : search;
+	if (sweeping) {
+		double avg = 0;
+		for (i = 0; i < n; i++)
+			avg += len[i];
+		if (limit == 0)
+			for (i = 0; i < nth; i++)
+				st[i].limit = 20000;
+		sweep(st, nth, fn, avg / n);
+		return 0;
 	}
+	double t;
+	long cand = run(st, nth, fn, &t);
+	printf("%ld candidates in %.2f s, %.0f candidates/s, %d threads\n", cand, t, cand / t, nth);
 }
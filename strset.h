@@ -0,0 +1,293 @@
+/*
+String sets for randbloom.c and friends
+
+Reading a list with fgets and strdup is one malloc per string and the
+strings end up all over the heap. Here the file is mapped and every string
+is copied once into a single arena:
+
+	uint32_t len; char s[len]; '\0'; padding to 8 bytes
+
+The arena starts on a cache line and the entries are 8-aligned, so s is
+4 bytes into the entry and a string of up to 51 bytes fits into one line
+with its length. Duplicates are dropped with an open addressing table
+over the indices, with the hash next to each one, so a probe touches
+the arena only when the hashes match. The table is rebuilt when it's half
+full, loaders size it (and the arena) up front from the file size.
+
+Strings come from a text file, one per line, or from the .dynsym of an
+ELF file (defined symbols only, that's what the loader resolves). After
+loading, strset_done() fills s[] and len[], pointers into the arena, they
+are valid until the set is freed.
+*/
+#ifndef _STRSET_H_
+#define _STRSET_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct strset {
+	uint8_t *arena;
+	size_t size, cap;
+	uint32_t *off;		/* entry offsets */
+	int n, max;
+	uint64_t *ht;		/* hash << 32 | index + 1, 0 is empty */
+	uint32_t hmask;
+	/* after strset_done() */
+	char **s;
+	int *len;
+};
+
+static inline uint32_t strset_hash(const char *p, int len)
+{
+	uint32_t h = 2166136261U;
+	while (len--)
+		h = (h ^ (uint8_t)*p++) * 16777619U;
+	return h;
+}
+
+static inline void strset_init(struct strset *ss)
+{
+	memset(ss, 0, sizeof(*ss));
+}
+
+static inline void strset_free(struct strset *ss)
+{
+	free(ss->arena);
+	free(ss->off);
+	free(ss->ht);
+	free(ss->s);
+	free(ss->len);
+	strset_init(ss);
+}
+
+static inline int strset_rehash(struct strset *ss, uint32_t slots)
+{
+	uint64_t *ht = calloc(slots, sizeof(uint64_t));
+	if (ht == NULL)
+		return -1;
+	for (uint32_t i = 0; ss->ht && i <= ss->hmask; i++) {
+		uint32_t k = (ss->ht[i] >> 32) & (slots - 1);
+		if (ss->ht[i] == 0)
+			continue;
+		while (ht[k])
+			k = (k + 1) & (slots - 1);
+		ht[k] = ss->ht[i];
+	}
+	free(ss->ht);
+	ss->ht = ht;
+	ss->hmask = slots - 1;
+	return 0;
+}
+
+/* room for n more strings of total length bytes, 0 or -1 */
+static inline int strset_reserve(struct strset *ss, size_t bytes, int n)
+{
+	uint32_t slots = ss->ht ? ss->hmask + 1 : 1024;
+	while (slots / 2 < (uint32_t)(ss->n + n))
+		slots *= 2;
+	if ((!ss->ht || slots > ss->hmask + 1) && strset_rehash(ss, slots) < 0)
+		return -1;
+	if (ss->n + n > ss->max) {
+		uint32_t *o = realloc(ss->off, (ss->n + n) * sizeof(uint32_t));
+		if (o == NULL)
+			return -1;
+		ss->off = o;
+		ss->max = ss->n + n;
+	}
+	size_t cap = ss->size + bytes + (size_t)n * 12;
+	if (cap > ss->cap) {
+		uint8_t *a;
+		if (posix_memalign((void **)&a, 64, cap))
+			return -1;
+		if (ss->arena)
+			memcpy(a, ss->arena, ss->size);
+		free(ss->arena);
+		ss->arena = a;
+		ss->cap = cap;
+	}
+	return 0;
+}
+
+/* slot of the string or the empty slot where it goes */
+static inline uint32_t strset_slot(struct strset *ss, const char *p, int len, uint32_t h)
+{
+	uint32_t k = h & ss->hmask;
+	for (; ss->ht[k]; k = (k + 1) & ss->hmask) {
+		if (ss->ht[k] >> 32 != h)
+			continue;
+		uint32_t *e = (uint32_t *)(ss->arena + ss->off[(uint32_t)ss->ht[k] - 1]);
+		if (*e == (uint32_t)len && memcmp(e + 1, p, len) == 0)
+			break;
+	}
+	return k;
+}
+
+/* index of the string or -1 */
+static inline int strset_find(struct strset *ss, const char *p, int len)
+{
+	return ss->ht ? (int)(uint32_t)ss->ht[strset_slot(ss, p, len, strset_hash(p, len))] - 1 : -1;
+}
+
+/* index of the string, new or old, -1 if out of memory; h is strset_hash() */
+static inline int strset_add_h(struct strset *ss, const char *p, int len, uint32_t h)
+{
+	if ((uint32_t)(ss->n + 1) * 2 > ss->hmask + 1 && strset_rehash(ss, ss->ht ? (ss->hmask + 1) * 2 : 1024) < 0)
+		return -1;
+	uint32_t k = strset_slot(ss, p, len, h);
+	if (ss->ht[k])
+		return (uint32_t)ss->ht[k] - 1;
+	size_t need = (4 + len + 1 + 7) & ~7UL;
+	if ((ss->size + need > ss->cap || ss->n == ss->max) &&
+	    strset_reserve(ss, ss->cap + need, ss->max ? ss->max : 1024) < 0)
+		return -1;
+	uint8_t *e = ss->arena + ss->size;
+	memcpy(e, &(uint32_t){ len }, 4);
+	memcpy(e + 4, p, len);
+	memset(e + 4 + len, 0, need - 4 - len);
+	ss->off[ss->n] = ss->size;
+	ss->size += need;
+	ss->ht[k] = (uint64_t)h << 32 | ++ss->n;
+	return ss->n - 1;
+}
+
+static inline int strset_add(struct strset *ss, const char *p, int len)
+{
+	return strset_add_h(ss, p, len, strset_hash(p, len));
+}
+
+static inline void *strset_map(const char *path, size_t *size)
+{
+	struct stat st;
+	void *m = MAP_FAILED;
+	int h = open(path, O_RDONLY);
+	if (h < 0)
+		return NULL;
+	if (fstat(h, &st) == 0) {
+		*size = st.st_size;
+		if (st.st_size > 0)
+			m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, h, 0);
+		else
+			errno = EINVAL;
+	}
+	close(h);
+	return m == MAP_FAILED ? NULL : m;
+}
+
+/* one string per line, \r\n is fine, empty lines are skipped; strings added or -1 */
+static inline int strset_load_list(struct strset *ss, const char *path)
+{
+	size_t size;
+	const char *m = strset_map(path, &size), *p, *e, *nl;
+	int n0 = ss->n;
+	if (m == NULL)
+		return -1;
+	/* count the lines first, memchr is cheap next to the table */
+	int lines = 1;
+	for (p = m, e = m + size; (p = memchr(p, '\n', e - p)) != NULL; p++)
+		lines++;
+	if (strset_reserve(ss, size, lines) < 0) {
+		munmap((void *)m, size);
+		return -1;
+	}
+	/*
+	The table is much larger than the cache for big lists, so lines go
+	in batches: hash and prefetch the slots of 16 lines, then insert.
+	*/
+	struct { const char *p; int len; uint32_t h; } b[16];
+	int nb, i;
+	for (p = m, e = m + size; p < e; ) {
+		for (nb = 0; nb < 16 && p < e; p = nl + 1) {
+			if ((nl = memchr(p, '\n', e - p)) == NULL)
+				nl = e;
+			const char *q = nl;
+			while (q > p && q[-1] == '\r')
+				q--;
+			if (q == p)
+				continue;
+			b[nb].p = p;
+			b[nb].len = q - p;
+			b[nb].h = strset_hash(p, q - p);
+			__builtin_prefetch(&ss->ht[b[nb].h & ss->hmask]);
+			nb++;
+		}
+		for (i = 0; i < nb; i++)
+			if (strset_add_h(ss, b[i].p, b[i].len, b[i].h) < 0) {
+				munmap((void *)m, size);
+				return -1;
+			}
+	}
+	munmap((void *)m, size);
+	return ss->n - n0;
+}
+
+/* defined symbols from .dynsym of an ELF64 file; strings added or -1 */
+static inline int strset_load_elf(struct strset *ss, const char *path)
+{
+	size_t size;
+	uint8_t *m = strset_map(path, &size);
+	int n0 = ss->n, err = EINVAL;
+	if (m == NULL)
+		return -1;
+	Elf64_Ehdr *eh = (Elf64_Ehdr *)m;
+	if (size < sizeof(Elf64_Ehdr) || memcmp(eh->e_ident, ELFMAG, SELFMAG) || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    eh->e_shoff > size || (size - eh->e_shoff) / sizeof(Elf64_Shdr) < eh->e_shnum)
+		goto out;
+	Elf64_Shdr *sh = (Elf64_Shdr *)(m + eh->e_shoff);
+	for (int i = 0; i < eh->e_shnum; i++) {
+		if (sh[i].sh_type != SHT_DYNSYM)
+			continue;
+		if (sh[i].sh_link >= eh->e_shnum)
+			goto out;
+		Elf64_Shdr *str = &sh[sh[i].sh_link];
+		if (sh[i].sh_offset > size || sh[i].sh_size > size - sh[i].sh_offset ||
+		    str->sh_offset > size || str->sh_size > size - str->sh_offset || str->sh_size == 0)
+			goto out;
+		Elf64_Sym *sym = (Elf64_Sym *)(m + sh[i].sh_offset);
+		const char *names = (char *)m + str->sh_offset;
+		size_t nsym = sh[i].sh_size / sizeof(Elf64_Sym);
+		for (size_t j = 1; j < nsym; j++) {
+			if (sym[j].st_shndx == SHN_UNDEF || sym[j].st_name >= str->sh_size)
+				continue;
+			const char *p = names + sym[j].st_name;
+			size_t len = strnlen(p, str->sh_size - sym[j].st_name);
+			if (len && strset_add(ss, p, len) < 0) {
+				err = ENOMEM;
+				goto out;
+			}
+		}
+		err = 0;
+	}
+	if (err)
+		err = ENOENT;
+out:
+	munmap(m, size);
+	errno = err;
+	return err ? -1 : ss->n - n0;
+}
+
+/* fills s[] and len[], 0 or -1 */
+static inline int strset_done(struct strset *ss)
+{
+	free(ss->s);
+	free(ss->len);
+	ss->s = malloc((ss->n + 1) * sizeof(char *));
+	ss->len = malloc((ss->n + 1) * sizeof(int));
+	if (ss->s == NULL || ss->len == NULL)
+		return -1;
+	for (int i = 0; i < ss->n; i++) {
+		uint32_t *e = (uint32_t *)(ss->arena + ss->off[i]);
+		ss->len[i] = *e;
+		ss->s[i] = (char *)(e + 1);
+	}
+	ss->s[ss->n] = NULL;
+	return 0;
+}
+
+#endif /* _STRSET_H_ */
@@ -59,33 +59,31 @@ int main(int argc, char **argv)
 	printf("init %lx fini %lx\n", init, fini);
 
 	/* disassemble */
-	int len;
+	size_t n = fini - init, k;
+	uint32_t *off = malloc(n * sizeof(uint32_t)), *flags = malloc(n * sizeof(uint32_t)), *disp = malloc(n * sizeof(uint32_t));
+	uint8_t *len = malloc(n), *opcode = malloc(n), *modrm = malloc(n);
+	uint64_t *imm = malloc(n * sizeof(uint64_t));
+	assert(off && flags && disp && len && opcode && modrm && imm);
+	hde64_soa soa = { .off = off, .len = len, .opcode = opcode, .modrm = modrm, .flags = flags, .imm = imm, .disp = disp };
+	n = hde64_batch(map + init, fini - init, n, &soa);
+
 	struct code {
 		unsigned flags, imm, off, is_func, len, opcode, visited, modrm, disp;
 		struct code *link, *next, *func;
-	} *code = NULL, *tail = NULL, *c, *fast[fini];
+	} *code = calloc(n, sizeof(struct code)), *tail = NULL, *c, *fast[fini];
+	assert(code != NULL);
 	bzero(fast, sizeof(fast));
-	for (Elf64_Addr i = init; i < fini; i += len) {
-		hde64s hs;
-		len = hde64_disasm(map + i, &hs);
-		assert(len > 0);
-		c = malloc(sizeof(struct code));
-		assert(c != NULL);
-		c->opcode = hs.opcode;
-		c->off = i;
-		c->len = len;
-		c->flags = hs.flags;
-		c->imm = hs.imm.imm32;
-		c->disp = hs.disp.disp32;
-		c->modrm = hs.modrm;
-		if (code == NULL) {
-			code = c;
-			tail = c;
-		} else {
-			tail->next = c;
-			tail = c;
-		}
-		fast[i] = c;
+	for (k = 0; k < n; k++) {
+		c = &code[k];
+		c->opcode = opcode[k];
+		c->off = init + off[k];
+		c->len = len[k];
+		c->flags = flags[k];
+		c->imm = imm[k];
+		c->disp = disp[k];
+		c->modrm = modrm[k];
+		c->next = k + 1 < n ? c + 1 : NULL;
+		fast[c->off] = c;
 	}
 
 	/* link calls/jmps, mark functions */